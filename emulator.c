@@ -36,21 +36,106 @@
    ********************************************************************* */
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include "emulator.h"
+#include "evtrace.h"
 #include "sr.h"
+#include "sweep.h"
+
+/* Hot path instrumentation, compiled in with -DPROFILE.  PROF_BEGIN and */
+/* PROF_END bracket a scope and add one call and the ticks between them  */
+/* to a counter of the simulation; a run prints the counters to stderr.  */
+/* Ticks are TSC cycles on x86 and nanoseconds elsewhere.  Scopes nest,  */
+/* so a handler's ticks include the tolayer3() and timer calls it makes. */
+/* Without -DPROFILE the macros are empty.                               */
+#ifdef PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define proftick() __rdtsc()
+#define PROF_UNIT "cycles"
+#else
+#include <time.h>
+static unsigned long long proftick(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#define PROF_UNIT "ns"
+#endif
+#define PROF_BEGIN(point) unsigned long long prof_##point = proftick()
+#define PROF_END(s, point) \
+  ((s)->prof[PROF_##point].calls++, (s)->prof[PROF_##point].ticks += proftick() - prof_##point)
+#else
+#define PROF_BEGIN(point)
+#define PROF_END(s, point)
+#endif
+
+/* profiled scopes */
+#define PROF_DISPATCH 0     /* one event of the main loop, handler included */
+#define PROF_NEXTEVENT 1    /* taking the next event from the event list */
+#define PROF_INSERTEVENT 2
+#define PROF_WHEEL 3        /* advancing the timing wheel a tick */
+#define PROF_PKTCOPY 4      /* copying a packet sent by value, or shared and corrupted */
+#define PROF_TOLAYER3 5
+#define PROF_TOLAYER5 6
+#define PROF_STARTTIMER 7
+#define PROF_STOPTIMER 8
+#define PROF_A_OUTPUT 9
+#define PROF_A_INPUT 10
+#define PROF_B_INPUT 11
+#define PROF_A_TIMER 12
+#define PROF_POINTS 13
+
+struct profpoint
+{
+  long long calls;
+  unsigned long long ticks;
+};
+
+/* a packet buffer; the packet is shared by everyone holding a reference. */
+/* Room for the MTU follows it, and pkt.payload points there.            */
+struct pktbuf
+{
+  int refs;
+  struct pktbuf *next; /* free list */
+  double arrival;      /* send stamp: the time the message in it came */
+                       /* from layer 5, negative if it carries none    */
+  int received;        /* a copy of it has reached B */
+  int resent;          /* the first copy to reach B was a resend */
+  int delivered;       /* B has delivered it */
+  struct pkt pkt;
+};
+
+/* Packet buffers come in slabs of POOL_SLAB as well, but no larger than */
+/* PKT_SLABBYTES for a large MTU.                                        */
+#define PKT_SLABBYTES (1 << 20)
 
 struct event
 {
-  float evtime;       /* event time */
+  double evtime;      /* event time */
   int evtype;         /* event type code */
   int eventity;       /* entity where event occurs */
-  struct pkt *pktptr; /* ptr to packet (if any) assoc w/ this event */
-  struct event *prev;
+  struct pkt *pkt;    /* packet (if any) assoc w/ this event, a reference */
+  int resent;         /* the packet of a FROM_LAYER3 event is a resend by A */
+  unsigned long seq;  /* insertion sequence number, breaks evtime ties */
+  int heapidx;        /* current position of this event in evheap */
+  int wheelidx;       /* timing wheel slot of a timer, or WHEEL_DUE */
+  struct event *prev; /* neighbours in a calendar bucket */
   struct event *next;
 };
 
-struct event *evlist = NULL; /* the event list */
-
 /* possible events: */
 #define TIMER_INTERRUPT 0
 #define FROM_LAYER5 1
@@ -59,444 +144,3226 @@ struct event *evlist = NULL; /* the event list */
 #define OFF 0
 #define ON 1
 
-int TRACE = 3;
-
-/* statistics updated by GBN */
-int window_full; /* count of the number of messages dropped due to full window */
-int total_ACKs_received;
-int packets_resent;   /* count of the number of packets resent  */
-int new_ACKs;         /* count of the number of acks correctly received */
-int packets_received; /* count of the packets received by receiver */
-
-/* statistics updated by emulator */
-static int packets_lost;
-static int packets_corrupt;
-static int packets_sent;
-static int packets_timeout;
-static int messages_delivered;
-
-static int nsim = 0;    /* number of messages from 5 to 4 so far */
-static int nsimmax = 0; /* number of msgs to generate, then stop */
-static float time = 0.000;
-static float lossprob;       /* probability that a packet is dropped  */
-static float corruptprob;    /* probability that one bit is packet is flipped */
-static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
-static float lambda;         /* arrival rate of messages from layer 5 */
-static int ntolayer3;        /* number sent into layer 3 */
-static int nlost;            /* number lost in media */
-static int ncorrupt;         /* number corrupted by media*/
+/* calendar queue scheduler (R. Brown, CACM 31(10), 1988).  Bucket i holds */
+/* the events whose "day" floor(evtime / cqwidth) is congruent to i modulo */
+/* cqnbuckets, each bucket kept sorted.  The number of buckets tracks the  */
+/* number of pending events and the bucket width is re-estimated from the  */
+/* spacing of the earliest events whenever the calendar is resized.        */
+#define CQ_MINBUCKETS 16
+#define CQ_SAMPLE 25
+
+/* per-channel FIFO scheduler.  The medium never reorders, so the packets */
+/* in flight towards an entity arrive in the order they were scheduled,  */
+/* and apart from them there is at most one timer per entity and one     */
+/* pending layer 5 arrival.  Each kind of event gets its own FIFO or     */
+/* slot and the next event is the earliest of the five heads.            */
+struct evring
+{
+  struct event **slot; /* circular buffer of events, in arrival order */
+  int head;            /* index of the earliest event */
+  int count;           /* number of events in the ring */
+  int size;            /* allocated size of slot, a power of 2 */
+};
+
+/* Hierarchical timing wheel (-w).  When enabled, TIMER_INTERRUPT events  */
+/* are kept here rather than in the event set, and the main loop takes    */
+/* whichever of the two heads is earlier.  Time is divided into ticks of  */
+/* WHEEL_TICK; level L holds the timers that fall in the current block of */
+/* WHEEL_SIZE^(L+1) ticks but not in the current block of WHEEL_SIZE^L    */
+/* ticks, and is cascaded one level down as the cursor wheelnow enters    */
+/* each of its slots.  Timers whose tick has been reached wait on the due */
+/* list, which is kept in dispatch order.  Every list is doubly linked,   */
+/* so cancelling a timer is O(1).                                         */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+#define WHEEL_TICK 1.0                              /* simulated time per tick */
+#define WHEEL_OVERFLOW (WHEEL_LEVELS * WHEEL_SIZE) /* beyond the top level */
+#define WHEEL_DUE (-1)
+
+/* Events are recycled through a free list rather than going back to    */
+/* malloc() after dispatch.  Fresh events are carved out of slabs of     */
+/* POOL_SLAB records, which are kept until the simulation is destroyed.  */
+#define POOL_SLAB 1024
+
+/* state of the random number generator behind jimsrand(): the additive */
+/* feedback generator x[i] = x[i-3] + x[i-31] used by glibc's rand()    */
+#define RAND_DEG 31
+#define RAND_SEP 3
+
+/* what a random number is drawn for.  RNG_XOSHIRO gives each stream a */
+/* generator of its own, so changing how often one is drawn from does  */
+/* not disturb the others; RNG_COMPAT draws them all from one sequence. */
+#define STREAM_ARRIVAL 0 /* time to the next layer 5 message */
+#define STREAM_LOSS 1    /* whether a packet is lost */
+#define STREAM_DELAY 2   /* channel delay of a packet */
+#define STREAM_CORRUPT 3 /* whether and how a packet is corrupted */
+#define RAND_STREAMS 4
+
+/* RNG_XOSHIRO draws come from blocks of RAND_BLOCK numbers per stream, */
+/* filled by RAND_LANES generators stepped side by side so the fill    */
+/* loop vectorises.  Draw i of a block comes from lane i % RAND_LANES.  */
+#define RAND_LANES 8
+#define RAND_BLOCK 512 /* a multiple of RAND_LANES */
+
+/* Trace output is formatted into one buffer while a writer thread copies */
+/* the other to stdout, so the simulation waits only when it gets a whole */
+/* buffer ahead of the terminal or file behind stdout.                    */
+#define TRACE_BUFSIZE 65536
+
+/* binary event trace.  A trace that grows is written through a window */
+/* of EVTRACE_WINDOW records mapped at a time; a ring is mapped whole.   */
+/* Record offsets in the file need not fall on a page boundary, so a    */
+/* mapping starts at the page that holds its first byte.                */
+#define EVTRACE_WINDOW 65536 /* 1.5 MiB of records */
+
+struct recorder
+{
+  int fd;
+  long pagesize;
+  struct evtraceheader *header; /* the start of the file */
+  struct evrecord *window;      /* the mapped records */
+  long long windowstart;        /* number of the record in window[0] */
+  long long nwindow;            /* records in the window, the capacity of a ring */
+  long long written;            /* records written */
+  int ring;
+};
+
+/* Channel decisions, recorded with -D and replayed with -R.  The file */
+/* is CHAN_MAGIC followed by one record per draw of the arrival process */
+/* and one per packet handed to tolayer3().  A replay reads the records */
+/* for arrivals, packets from A and packets from B through three        */
+/* separate cursors, so each sender gets the decisions recorded for its */
+/* n-th packet however the protocol interleaves its sends.              */
+#define CHAN_MAGIC "SRCHAN01"
+
+#define CHAN_ARRIVAL 0 /* record kinds */
+#define CHAN_PACKET 1
+
+#define CHAN_INTACT 0 /* packet fates */
+#define CHAN_LOST 1
+#define CHAN_PAYLOAD 2 /* corrupted: payload[0] overwritten */
+#define CHAN_SEQNUM 3  /* corrupted: seqnum overwritten */
+#define CHAN_ACKNUM 4  /* corrupted: acknum overwritten */
+
+struct chanrecord
+{
+  double u; /* the uniform draw for the arrival interval or the delay */
+  unsigned char kind;
+  unsigned char entity; /* sender of a packet */
+  unsigned char fate;
+  unsigned char unused[5];
+};
+
+struct channel
+{
+  FILE *record;     /* file decisions are recorded to, or NULL */
+  FILE *replay[3];  /* cursors for arrivals, packets from A and from B */
+  int replaying;    /* the packet in cur comes from the replay file */
+  struct chanrecord cur; /* decisions about the packet being sent */
+};
+
+/* Delivery latency.  The packet buffer A first sends a message in is   */
+/* stamped with the time the message arrived from layer 5, and A's      */
+/* resends share that buffer.  Each copy on its way is marked as a      */
+/* first send or a resend, and the buffer keeps the mark of the copy    */
+/* that reaches B first.  When B delivers the payload of a packet with  */
+/* tolayer5_packet(), the stamp and the mark are in its buffer.  A      */
+/* delivery of a message already delivered, or of data that carries no  */
+/* stamp (passed to plain tolayer5(), or sent by value and then         */
+/* resent), is counted but has no latency.  Latencies are counted in a  */
+/* log-bucketed histogram of LATENCY_UNIT steps: values below           */
+/* 2*HIST_SUB steps have a bucket each, and above that every power of   */
+/* two is split into HIST_SUB buckets, so a bucket is within 1/HIST_SUB */
+/* of the values in it.                                                 */
+#define LATENCY_UNIT 1000.0 /* histogram steps per unit of simulated time */
+#define HIST_SUBBITS 7
+#define HIST_SUB (1 << HIST_SUBBITS)
+#define HIST_MAXSHIFT 33 /* longer latencies are counted as the longest */
+#define HIST_SIZE ((HIST_MAXSHIFT + 2) * HIST_SUB)
+
+struct latencyhist
+{
+  long long bucket[HIST_SIZE];
+  long long count;
+  double max; /* exact */
+};
+
+/* Counters at one moment of a run, for rates over part of it.  The     */
+/* steady state runs from the arrival from layer 5 of message            */
+/* nsimmax / WARMUP_FRACTION to that of the last message, leaving out    */
+/* the warm-up while the window first fills and the drain at the end.    */
+#define WARMUP_FRACTION 10
+#define MARK_WARM 0 /* the end of the warm-up */
+#define MARK_LAST 1 /* the last message arrives */
+
+struct mark
+{
+  double time;
+  long long nsim, delivered, window_full, resent;
+  long long sent[2]; /* packets A and B sent into layer 3 */
+};
+
+struct tracesink
+{
+  char *buf[2];
+  int active;  /* buffer being filled */
+  int len;     /* bytes used in buf[active] */
+  int pending; /* bytes of buf[!active] the writer has yet to write */
+  int stop;    /* tells the writer to exit */
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+/* Everything one simulation run needs.  Nothing in here is shared with */
+/* other runs, so independent simulations can proceed side by side in  */
+/* one process, one per thread.                                        */
+struct sim
+{
+  /* configuration */
+  int trace;
+  long long nsimmax;    /* number of msgs to generate, then stop */
+  float lossprob;       /* probability that a packet is dropped  */
+  float corruptprob;    /* probability that one bit is packet is flipped */
+  int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
+  float lambda;         /* arrival rate of messages from layer 5 */
+  unsigned seed;        /* random number generator seed */
+  int rng;              /* RNG_COMPAT or RNG_XOSHIRO */
+  int clock;            /* CLOCK_FLOAT, CLOCK_DOUBLE or CLOCK_TICKS, see clockround() */
+  int windowsize;       /* protocol window size, 0 = protocol default */
+  int msgsize;          /* bytes per message from layer 5 */
+  int mtu;              /* largest payload a packet carries */
+  double bandwidth;     /* payload bytes per time unit, 0 for none */
+
+  struct tracesink *sink; /* trace output, NULL until something is printed */
+  struct recorder *recorder; /* binary event trace, NULL if not recorded */
+  struct channel *channel;   /* channel record or replay, NULL if neither */
+
+  /* time series of the protocol state, written while sim_run() takes */
+  /* events from the event list, so that no event or random draw is   */
+  /* added: the sample for time t is the state after the events before t */
+  FILE *sampler;         /* NULL if not sampled */
+  double sampleinterval; /* simulated time between samples */
+  double nextsample;     /* time of the next sample */
+
+  double time;
+  long long nsim;    /* number of messages from 5 to 4 so far */
+  long long nevents; /* events taken from the event list */
+
+  /* statistics updated by SR */
+  struct protostats stats;
+
+  /* statistics updated by emulator */
+  long long messages_delivered;
+  long long ntolayer3; /* number sent into layer 3 */
+  long long nsent[2];  /* of them, the ones A and B sent */
+  int inflight;        /* packets in the medium */
+  long long nlost;     /* number lost in media */
+  long long ncorrupt;  /* number corrupted by media*/
+
+  /* protocol state of A and B, see sim_setentity() */
+  void *entity[2];
+
+  /* delivery latency; while A_output() runs for a message, sending is */
+  /* set and arrival holds the time the message came from layer 5      */
+  int sending;
+  double arrival;
+  struct latencyhist latency[2]; /* LATENCY_FIRST, LATENCY_RESENT */
+  long long redelivered;         /* msgs B delivered again */
+  long long unstamped;           /* msgs B delivered without a send stamp */
+
+  struct mark mark[2]; /* MARK_WARM, MARK_LAST */
+
+  /* The pending events are ordered on (evtime, seq).  Among events with */
+  /* the same evtime the most recently inserted one comes first, which   */
+  /* is the order the original sorted linked list produced.  Three       */
+  /* interchangeable implementations of the event set are available: a   */
+  /* binary min-heap (the default), a calendar queue and per-channel     */
+  /* FIFO queues.                                                        */
+  int scheduler;
+  int evcount;         /* number of pending events */
+  unsigned long evseq; /* next insertion sequence number */
+
+  /* the outstanding TIMER_INTERRUPT event of A and B, NULL if not running */
+  struct event *timerevent[2];
+
+  /* latest arrival time scheduled on the channel towards A and towards B. */
+  /* Arrivals on a channel are scheduled in increasing time order, so this  */
+  /* is the arrival time of the last packet in flight to that entity, or a */
+  /* time already in the past once the channel has drained.                */
+  double chantail[2];
+
+  /* binary heap scheduler */
+  struct event **evheap; /* heap array of pending events */
+  int evcapacity;        /* allocated size of evheap */
+
+  /* calendar queue scheduler */
+  struct event **cqbucket; /* sorted list per bucket */
+  int cqnbuckets;          /* number of buckets, a power of 2 */
+  double cqwidth;          /* simulated time covered by a bucket */
+  long long cqday;         /* day of the last dequeued event */
+  int cqresizing;          /* suppresses resizes while rebuilding */
+
+  /* per-channel FIFO scheduler */
+  struct evring chanq[2];     /* packets in flight to A and B */
+  struct event *fifotimer[2]; /* timers of A and B */
+  struct event *fifoarrival;  /* next message from layer 5 */
+
+  /* timing wheel */
+  int usewheel;
+  struct event *wheelslot[WHEEL_OVERFLOW + 1];
+  int wheellevelcount[WHEEL_LEVELS + 1]; /* timers per level, overflow last */
+  struct event *wheeldue;                /* timers at or before wheelnow */
+  long long wheelnow;                    /* the tick the wheel has reached */
+  int wheelcount;                        /* timers in the wheel, due included */
+
+  /* event pool */
+  struct event *evfree; /* free list, linked through next */
+  struct event **slabs; /* every slab allocated, for sim_destroy() */
+  int pool_inuse;       /* events currently handed out */
+  int pool_highwater;   /* largest value pool_inuse reached */
+  int pool_slabs;       /* number of slabs allocated */
+
+  /* packet buffer pool, in slabs like the event pool */
+  struct pktbuf *pktfree;
+  struct pktbuf **pktslabs;
+  int pkt_slabs;
+  size_t pktsize; /* bytes per buffer, payload included */
+  int pktperslab;
+
+  char *msgdata; /* contents of the message from layer 5, msgsize bytes */
+
+  /* random number generator, RNG_COMPAT */
+  int randstate[RAND_DEG];
+  int randfront, randrear;
+
+  /* random number generators, RNG_XOSHIRO */
+  unsigned long long xoshiro[RAND_STREAMS][4][RAND_LANES]; /* state word, lane */
+  double randblock[RAND_STREAMS][RAND_BLOCK];              /* pre-generated draws */
+  int randnext[RAND_STREAMS];                              /* next unused draw */
+
+#ifdef PROFILE
+  struct profpoint prof[PROF_POINTS];
+#endif
+};
+
+/* With CLOCK_TICKS a time is a whole number of ticks of 1/TICKS_PER_UNIT. */
+/* The tick is a power of two, so a time is held exactly by a double up  */
+/* to 2^53 ticks (about 1.4e11 time units) and adding a delay to it is   */
+/* exact integer arithmetic: no time is ever rounded, and t * TICKS_PER_ */
+/* UNIT is the 64-bit tick count.                                        */
+#define TICKS_PER_UNIT 65536.0
+
+/* a time just computed, as the clock of the simulation keeps it */
+static double clockround(const struct sim *s, double t)
+{
+  return s->clock == CLOCK_FLOAT ? (float)t : t;
+}
+
+/* a delay to add to a time: with CLOCK_TICKS truncated to whole ticks */
+static double clockdelay(const struct sim *s, double d)
+{
+  if (s->clock == CLOCK_TICKS)
+    return (long long)(d * TICKS_PER_UNIT) / TICKS_PER_UNIT;
+  return d;
+}
+
+/****************************************************************************/
+/* jimsrand(): return a double in range [0,1].  The routine below is used to */
+/* isolate all random number generation in one location.  Each simulation   */
+/* carries its own generators.  RNG_COMPAT is a copy of the generator behind */
+/* the C library's rand() on glibc and reproduces the numbers rand() gave;   */
+/* RNG_XOSHIRO runs RAND_LANES xoshiro256** generators per stream and hands */
+/* out their numbers from a block that is refilled when used up.            */
+/****************************************************************************/
+/* next value in [0,2^31-1], as rand() would have returned it */
+static int nextrand(struct sim *s)
+{
+  unsigned int x;
+
+  x = (unsigned int)s->randstate[s->randfront] + (unsigned int)s->randstate[s->randrear];
+  s->randstate[s->randfront] = (int)x;
+  if (++s->randfront == RAND_DEG)
+    s->randfront = 0;
+  if (++s->randrear == RAND_DEG)
+    s->randrear = 0;
+  return (int)(x >> 1);
+}
+
+static void seedrand(struct sim *s, unsigned int seed)
+{
+  long hi, lo, word;
+  int i;
+
+  /* fill the state with a Lehmer sequence, then discard the start-up. */
+  /* The seed is unsigned, but glibc's srandom() keeps it in a 32-bit   */
+  /* int state word, so a seed of 2^31 or more starts out negative here */
+  /* as it does there                                                   */
+  s->randstate[0] = seed != 0 ? (int)seed : 1;
+  for (i = 1; i < RAND_DEG; i++)
+  {
+    hi = s->randstate[i - 1] / 127773;
+    lo = s->randstate[i - 1] % 127773;
+    word = 16807 * lo - 2836 * hi;
+    if (word < 0)
+      word += 2147483647;
+    s->randstate[i] = (int)word;
+  }
+  s->randfront = RAND_SEP;
+  s->randrear = 0;
+  for (i = 0; i < 10 * RAND_DEG; i++)
+    nextrand(s);
+}
+
+static unsigned long long rotl(unsigned long long x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+/* next value of one xoshiro256** generator */
+static unsigned long long xoshiro_next(unsigned long long *x)
+{
+  unsigned long long result = rotl(x[1] * 5, 7) * 9;
+  unsigned long long t = x[1] << 17;
+
+  x[2] ^= x[0];
+  x[3] ^= x[1];
+  x[1] ^= x[2];
+  x[0] ^= x[3];
+  x[2] ^= t;
+  x[3] = rotl(x[3], 45);
+  return result;
+}
+
+/* advance a generator by 2^128 values, the distance between two streams */
+static void xoshiro_jump(unsigned long long *x)
+{
+  static const unsigned long long jump[4] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL,
+                                             0x39abdc4529b1661cULL};
+  unsigned long long y[4] = {0, 0, 0, 0};
+  int i, b, k;
+
+  for (i = 0; i < 4; i++)
+    for (b = 0; b < 64; b++)
+    {
+      if (jump[i] & (1ULL << b))
+        for (k = 0; k < 4; k++)
+          y[k] ^= x[k];
+      xoshiro_next(x);
+    }
+  for (k = 0; k < 4; k++)
+    x[k] = y[k];
+}
+
+/* expand the seed with splitmix64 into one generator */
+static void seedsplitmix(unsigned long long *x, unsigned int seed)
+{
+  unsigned long long z, sm = seed;
+  int k;
+
+  for (k = 0; k < 4; k++)
+  {
+    z = (sm += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    x[k] = z ^ (z >> 31);
+  }
+}
+
+/* seed every lane of every stream, each 2^128 values past the previous */
+static void seedxoshiro(struct sim *s, unsigned int seed)
+{
+  unsigned long long x[4];
+  int i, l, k;
+
+  seedsplitmix(x, seed);
+  for (i = 0; i < RAND_STREAMS; i++)
+  {
+    for (l = 0; l < RAND_LANES; l++)
+    {
+      for (k = 0; k < 4; k++)
+        s->xoshiro[i][k][l] = x[k];
+      xoshiro_jump(x);
+    }
+    s->randnext[i] = RAND_BLOCK; /* empty, filled on first use */
+  }
+}
+
+/* refill the block of one stream.  The loop over the lanes is the     */
+/* scalar xoshiro256** step written so that the compiler vectorises it; */
+/* each number becomes a double in [0,1) through its top 52 bits.       */
+static void refillrand(struct sim *s, int stream)
+{
+  unsigned long long x0[RAND_LANES], x1[RAND_LANES], x2[RAND_LANES], x3[RAND_LANES];
+  unsigned long long r, t, u;
+  double *out = s->randblock[stream];
+  double d;
+  int i, l;
+
+  for (l = 0; l < RAND_LANES; l++)
+  {
+    x0[l] = s->xoshiro[stream][0][l];
+    x1[l] = s->xoshiro[stream][1][l];
+    x2[l] = s->xoshiro[stream][2][l];
+    x3[l] = s->xoshiro[stream][3][l];
+  }
+  for (i = 0; i < RAND_BLOCK; i += RAND_LANES)
+    for (l = 0; l < RAND_LANES; l++)
+    {
+      r = x1[l] * 5;
+      r = ((r << 7) | (r >> 57)) * 9;
+      t = x1[l] << 17;
+      x2[l] ^= x0[l];
+      x3[l] ^= x1[l];
+      x1[l] ^= x2[l];
+      x0[l] ^= x3[l];
+      x2[l] ^= t;
+      x3[l] = (x3[l] << 45) | (x3[l] >> 19);
+      u = (r >> 12) | 0x3ff0000000000000ULL; /* a double in [1,2) */
+      memcpy(&d, &u, sizeof(d));
+      out[i + l] = d - 1.0;
+    }
+  for (l = 0; l < RAND_LANES; l++)
+  {
+    s->xoshiro[stream][0][l] = x0[l];
+    s->xoshiro[stream][1][l] = x1[l];
+    s->xoshiro[stream][2][l] = x2[l];
+    s->xoshiro[stream][3][l] = x3[l];
+  }
+  s->randnext[stream] = 0;
+}
+
+/* every draw but a pre-generated one that need not be traced; kept out */
+/* of line so that jimsrand() is small enough to be inlined              */
+static __attribute__((noinline)) double slowrand(struct sim *s, int stream)
+{
+  double mmm = 2147483647; /* largest value nextrand() returns */
+  double x;
+  if (s->rng == RNG_XOSHIRO)
+  {
+    if (s->randnext[stream] == RAND_BLOCK)
+      refillrand(s, stream);
+    x = s->randblock[stream][s->randnext[stream]++];
+  }
+  else
+    x = nextrand(s) / mmm; /* x should be uniform in [0,1] */
+  if (TRACING(s, 4))
+    sim_printf(s, "RANDOM NUMBER GENERAION CALLED: %f\n", x);
+  return (x);
+}
+
+static double jimsrand(struct sim *s, int stream)
+{
+  if (s->rng == RNG_XOSHIRO && s->randnext[stream] < RAND_BLOCK && !TRACING(s, 4))
+    return s->randblock[stream][s->randnext[stream]++];
+  return slowrand(s, stream);
+}
+
+/********************* EVENT HANDLINE ROUTINES *******/
+/*  The next set of routines handle the event list   */
+/*****************************************************/
+
+/* returns non-zero if event p must be dispatched before event q */
+static int evbefore(const struct event *p, const struct event *q)
+{
+  if (p->evtime != q->evtime)
+    return p->evtime < q->evtime;
+  return p->seq > q->seq;
+}
+
+static void evheap_place(struct sim *s, struct event *p, int i)
+{
+  s->evheap[i] = p;
+  p->heapidx = i;
+}
+
+static void evheap_siftup(struct sim *s, int i)
+{
+  struct event *p = s->evheap[i];
+  int parent;
+
+  while (i > 0)
+  {
+    parent = (i - 1) / 2;
+    if (!evbefore(p, s->evheap[parent]))
+      break;
+    evheap_place(s, s->evheap[parent], i);
+    i = parent;
+  }
+  evheap_place(s, p, i);
+}
+
+static void evheap_siftdown(struct sim *s, int i)
+{
+  struct event *p = s->evheap[i];
+  int child;
+
+  while ((child = 2 * i + 1) < s->evcount)
+  {
+    if (child + 1 < s->evcount && evbefore(s->evheap[child + 1], s->evheap[child]))
+      child++;
+    if (!evbefore(s->evheap[child], p))
+      break;
+    evheap_place(s, s->evheap[child], i);
+    i = child;
+  }
+  evheap_place(s, p, i);
+}
+
+static void evheap_insert(struct sim *s, struct event *p)
+{
+  if (s->evcount == s->evcapacity)
+  {
+    s->evcapacity = s->evcapacity ? 2 * s->evcapacity : 64;
+    s->evheap = realloc(s->evheap, s->evcapacity * sizeof(struct event *));
+    if (s->evheap == 0)
+    {
+      printf("memory allocation for event list failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  s->evheap[s->evcount] = p;
+  p->heapidx = s->evcount++;
+  evheap_siftup(s, p->heapidx);
+}
+
+static void evheap_remove(struct sim *s, struct event *p)
+{
+  int i = p->heapidx;
+
+  s->evcount--;
+  if (i == s->evcount)
+    return;
+  evheap_place(s, s->evheap[s->evcount], i);
+  if (i > 0 && evbefore(s->evheap[i], s->evheap[(i - 1) / 2]))
+    evheap_siftup(s, i);
+  else
+    evheap_siftdown(s, i);
+}
+
+/* simulated time never goes negative, so truncation is floor() here */
+static long long cq_day(struct sim *s, double t)
+{
+  return (long long)(t / s->cqwidth);
+}
+
+static void cq_resize(struct sim *s, int nbuckets);
+
+/* link p into its bucket without touching seq or the resize logic */
+static void cq_link(struct sim *s, struct event *p)
+{
+  struct event **pp = &s->cqbucket[cq_day(s, p->evtime) & (s->cqnbuckets - 1)];
+  struct event *q = NULL;
+
+  while (*pp != NULL && evbefore(*pp, p))
+  {
+    q = *pp;
+    pp = &q->next;
+  }
+  p->prev = q;
+  p->next = *pp;
+  if (*pp != NULL)
+    (*pp)->prev = p;
+  *pp = p;
+  s->evcount++;
+}
+
+static void cq_unlink(struct sim *s, struct event *p)
+{
+  if (p->prev != NULL)
+    p->prev->next = p->next;
+  else
+    s->cqbucket[cq_day(s, p->evtime) & (s->cqnbuckets - 1)] = p->next;
+  if (p->next != NULL)
+    p->next->prev = p->prev;
+  s->evcount--;
+}
+
+static void cq_insert(struct sim *s, struct event *p)
+{
+  if (s->cqnbuckets == 0)
+    cq_resize(s, CQ_MINBUCKETS);
+  /* cq_peek() may have moved cqday up to an event that was not taken */
+  if (cq_day(s, p->evtime) < s->cqday)
+    s->cqday = cq_day(s, p->evtime);
+  cq_link(s, p);
+  if (!s->cqresizing && s->evcount > 2 * s->cqnbuckets)
+    cq_resize(s, 2 * s->cqnbuckets);
+}
+
+static void cq_remove(struct sim *s, struct event *p)
+{
+  cq_unlink(s, p);
+  if (!s->cqresizing && s->cqnbuckets > CQ_MINBUCKETS && s->evcount < s->cqnbuckets / 2)
+    cq_resize(s, s->cqnbuckets / 2);
+}
+
+/* return the earliest event; the calendar must not be empty */
+static struct event *cq_peek(struct sim *s)
+{
+  struct event *p, *best;
+  long long day;
+  int i;
+
+  /* scan one year of buckets starting from the current day.  The head of */
+  /* a bucket is the earliest event in it, and no pending event can be    */
+  /* on a day before cqday, so a head that falls on the day being looked  */
+  /* at is the earliest pending event.                                    */
+  for (day = s->cqday; day < s->cqday + s->cqnbuckets; day++)
+  {
+    p = s->cqbucket[day & (s->cqnbuckets - 1)];
+    if (p != NULL && cq_day(s, p->evtime) == day)
+    {
+      s->cqday = day;
+      return p;
+    }
+  }
+
+  /* every pending event is more than a year ahead: search directly */
+  best = NULL;
+  for (i = 0; i < s->cqnbuckets; i++)
+    if (s->cqbucket[i] != NULL && (best == NULL || evbefore(s->cqbucket[i], best)))
+      best = s->cqbucket[i];
+  s->cqday = cq_day(s, best->evtime);
+  return best;
+}
+
+/* remove and return the earliest event; the calendar must not be empty */
+static struct event *cq_pop(struct sim *s)
+{
+  struct event *p = cq_peek(s);
+
+  cq_remove(s, p);
+  return p;
+}
+
+/* rebuild the calendar with nbuckets buckets and a freshly estimated width */
+static void cq_resize(struct sim *s, int nbuckets)
+{
+  struct event *sample[CQ_SAMPLE];
+  struct event *all = NULL, *p, *pnext;
+  double gap, sum;
+  int nsample, nused, i;
+
+  s->cqresizing = 1;
+
+  /* the earliest few events are used to estimate the event spacing */
+  nsample = 0;
+  while (s->evcount > 0 && nsample < CQ_SAMPLE)
+    sample[nsample++] = cq_pop(s);
+  if (nsample > 1)
+  {
+    sum = 0.0;
+    for (i = 1; i < nsample; i++)
+      sum += sample[i]->evtime - sample[i - 1]->evtime;
+    gap = sum / (nsample - 1);
+    /* ignore the occasional large gap when averaging */
+    sum = 0.0;
+    nused = 0;
+    for (i = 1; i < nsample; i++)
+      if (sample[i]->evtime - sample[i - 1]->evtime <= 2.0 * gap)
+      {
+        sum += sample[i]->evtime - sample[i - 1]->evtime;
+        nused++;
+      }
+    if (nused > 0 && sum > 0.0)
+      s->cqwidth = 3.0 * sum / nused;
+    /* with whole ticks, a power of two width makes the day of a time */
+    /* exact: its tick count shifted right                            */
+    if (s->clock == CLOCK_TICKS)
+    {
+      for (gap = 1.0 / TICKS_PER_UNIT; 2 * gap <= s->cqwidth; gap *= 2)
+        ;
+      s->cqwidth = gap;
+    }
+  }
+
+  /* collect everything still in the calendar into one chain */
+  for (i = 0; i < s->cqnbuckets; i++)
+    for (p = s->cqbucket[i]; p != NULL; p = pnext)
+    {
+      pnext = p->next;
+      p->next = all;
+      all = p;
+    }
+
+  free(s->cqbucket);
+  s->cqbucket = calloc(nbuckets, sizeof(struct event *));
+  if (s->cqbucket == 0)
+  {
+    printf("memory allocation for event list failed.");
+    exit(EXIT_FAILURE);
+  }
+  s->cqnbuckets = nbuckets;
+  s->evcount = 0;
+  s->cqday = cq_day(s, s->time); /* nothing can be scheduled before the clock */
+  for (p = all; p != NULL; p = pnext)
+  {
+    pnext = p->next;
+    cq_link(s, p);
+  }
+  for (i = 0; i < nsample; i++)
+    cq_link(s, sample[i]);
+
+  s->cqresizing = 0;
+}
+
+static void sim_fatal(struct sim *s, const char *format, ...);
+
+static void fifo_panic(struct sim *s, const char *what)
+{
+  sim_fatal(s, "INTERNAL PANIC: fifo scheduler: %s\n", what);
+}
+
+static void fifo_insert(struct sim *s, struct event *p)
+{
+  struct evring *r;
+  struct event **slot;
+  int i;
+
+  if (p->evtype == TIMER_INTERRUPT)
+  {
+    if (s->fifotimer[p->eventity] != NULL)
+      fifo_panic(s, "second timer for an entity");
+    s->fifotimer[p->eventity] = p;
+  }
+  else if (p->evtype == FROM_LAYER5)
+  {
+    if (s->fifoarrival != NULL)
+      fifo_panic(s, "second pending layer 5 arrival");
+    s->fifoarrival = p;
+  }
+  else
+  {
+    r = &s->chanq[p->eventity];
+    if (r->count > 0 && p->evtime < r->slot[(r->head + r->count - 1) & (r->size - 1)]->evtime)
+      fifo_panic(s, "packet scheduled ahead of the channel");
+    if (r->count == r->size)
+    {
+      slot = malloc((r->size ? 2 * r->size : 64) * sizeof(struct event *));
+      if (slot == 0)
+      {
+        printf("memory allocation for event list failed.");
+        exit(EXIT_FAILURE);
+      }
+      for (i = 0; i < r->count; i++)
+        slot[i] = r->slot[(r->head + i) & (r->size - 1)];
+      free(r->slot);
+      r->slot = slot;
+      r->head = 0;
+      r->size = r->size ? 2 * r->size : 64;
+    }
+    /* packets at the same time as the tail (a float clock that has run */
+    /* out of precision) go ahead of it, the newest first as evbefore() */
+    /* orders them                                                      */
+    for (i = r->count; i > 0 && evbefore(p, r->slot[(r->head + i - 1) & (r->size - 1)]); i--)
+      r->slot[(r->head + i) & (r->size - 1)] = r->slot[(r->head + i - 1) & (r->size - 1)];
+    r->slot[(r->head + i) & (r->size - 1)] = p;
+    r->count++;
+  }
+  s->evcount++;
+}
+
+static void fifo_remove(struct sim *s, struct event *p)
+{
+  struct evring *r;
+
+  if (p->evtype == TIMER_INTERRUPT && s->fifotimer[p->eventity] == p)
+    s->fifotimer[p->eventity] = NULL;
+  else if (p->evtype == FROM_LAYER5 && s->fifoarrival == p)
+    s->fifoarrival = NULL;
+  else
+  {
+    /* packets only ever leave their channel from the front */
+    r = &s->chanq[p->eventity];
+    if (p->evtype != FROM_LAYER3 || r->count == 0 || r->slot[r->head] != p)
+      fifo_panic(s, "removing an event that is not at the head of its queue");
+    r->head = (r->head + 1) & (r->size - 1);
+    r->count--;
+  }
+  s->evcount--;
+}
+
+/* return the earliest event; the queues must not all be empty */
+static struct event *fifo_peek(struct sim *s)
+{
+  struct event *head[5];
+  struct event *best = NULL;
+  int i;
+
+  head[0] = s->chanq[A].count > 0 ? s->chanq[A].slot[s->chanq[A].head] : NULL;
+  head[1] = s->chanq[B].count > 0 ? s->chanq[B].slot[s->chanq[B].head] : NULL;
+  head[2] = s->fifotimer[A];
+  head[3] = s->fifotimer[B];
+  head[4] = s->fifoarrival;
+  for (i = 0; i < 5; i++)
+    if (head[i] != NULL && (best == NULL || evbefore(head[i], best)))
+      best = head[i];
+  return best;
+}
+
+static long long wheel_tick(double t)
+{
+  return (long long)(t / WHEEL_TICK);
+}
+
+static struct event **wheel_list(struct sim *s, struct event *p)
+{
+  return p->wheelidx == WHEEL_DUE ? &s->wheeldue : &s->wheelslot[p->wheelidx];
+}
+
+static void wheel_place(struct sim *s, struct event *p)
+{
+  struct event **pp, *q = NULL;
+  long long tick = wheel_tick(p->evtime);
+  int level;
+
+  if (tick <= s->wheelnow)
+  {
+    /* already due: keep the due list in dispatch order */
+    p->wheelidx = WHEEL_DUE;
+    for (pp = &s->wheeldue; *pp != NULL && evbefore(*pp, p); pp = &q->next)
+      q = *pp;
+  }
+  else
+  {
+    for (level = 0; level < WHEEL_LEVELS; level++)
+      if ((tick >> (WHEEL_BITS * (level + 1))) == (s->wheelnow >> (WHEEL_BITS * (level + 1))))
+        break;
+    if (level == WHEEL_LEVELS)
+      p->wheelidx = WHEEL_OVERFLOW;
+    else
+      p->wheelidx = level * WHEEL_SIZE + ((tick >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1));
+    s->wheellevelcount[level]++;
+    pp = &s->wheelslot[p->wheelidx];
+  }
+  p->prev = q;
+  p->next = *pp;
+  if (*pp != NULL)
+    (*pp)->prev = p;
+  *pp = p;
+}
+
+static void wheel_unlink(struct sim *s, struct event *p)
+{
+  if (p->prev != NULL)
+    p->prev->next = p->next;
+  else
+    *wheel_list(s, p) = p->next;
+  if (p->next != NULL)
+    p->next->prev = p->prev;
+  if (p->wheelidx != WHEEL_DUE)
+    s->wheellevelcount[p->wheelidx / WHEEL_SIZE]--;
+}
+
+/* re-place every timer of one slot relative to the current wheelnow */
+static void wheel_cascade(struct sim *s, int idx)
+{
+  struct event *p, *pnext;
+
+  p = s->wheelslot[idx];
+  s->wheelslot[idx] = NULL;
+  for (; p != NULL; p = pnext)
+  {
+    pnext = p->next;
+    s->wheellevelcount[idx / WHEEL_SIZE]--;
+    wheel_place(s, p);
+  }
+}
+
+/* move the cursor to the next tick that can hold timers */
+static void wheel_advance(struct sim *s)
+{
+  int level;
+  PROF_BEGIN(WHEEL);
+
+  /* skip over blocks of ticks whose level holds nothing */
+  for (level = 0; level < WHEEL_LEVELS && s->wheellevelcount[level] == 0; level++)
+    s->wheelnow |= ((long long)1 << (WHEEL_BITS * (level + 1))) - 1;
+  s->wheelnow++;
+
+  if ((s->wheelnow & (((long long)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1)) == 0)
+    wheel_cascade(s, WHEEL_OVERFLOW);
+  for (level = WHEEL_LEVELS - 1; level > 0; level--)
+    if ((s->wheelnow & (((long long)1 << (WHEEL_BITS * level)) - 1)) == 0)
+      wheel_cascade(s, level * WHEEL_SIZE + ((s->wheelnow >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1)));
+  wheel_cascade(s, s->wheelnow & (WHEEL_SIZE - 1));
+  PROF_END(s, WHEEL);
+}
+
+static void wheel_insert(struct sim *s, struct event *p)
+{
+  wheel_place(s, p);
+  s->wheelcount++;
+}
+
+static void wheel_remove(struct sim *s, struct event *p)
+{
+  wheel_unlink(s, p);
+  s->wheelcount--;
+}
+
+/* return the earliest timer, NULL if there is none */
+static struct event *wheel_peek(struct sim *s)
+{
+  if (s->wheelcount == 0)
+    return NULL;
+  while (s->wheeldue == NULL)
+    wheel_advance(s);
+  return s->wheeldue;
+}
+
+void insertevent(struct sim *s, struct event *p)
+{
+  PROF_BEGIN(INSERTEVENT);
+
+  if (TRACING(s, 3))
+  {
+    sim_printf(s, "            INSERTEVENT: time is %f\n", s->time);
+    sim_printf(s, "            INSERTEVENT: future time will be %f\n", p->evtime);
+  }
+  p->seq = s->evseq++;
+  if (s->usewheel && p->evtype == TIMER_INTERRUPT)
+    wheel_insert(s, p);
+  else
+  {
+    switch (s->scheduler)
+    {
+    case SCHEDULER_CALENDAR:
+      cq_insert(s, p);
+      break;
+    case SCHEDULER_FIFO:
+      fifo_insert(s, p);
+      break;
+    default:
+      evheap_insert(s, p);
+    }
+  }
+  PROF_END(s, INSERTEVENT);
+}
+
+/* unlink event p from the event list (the caller owns it afterwards) */
+static void removeevent(struct sim *s, struct event *p)
+{
+  if (s->usewheel && p->evtype == TIMER_INTERRUPT)
+  {
+    wheel_remove(s, p);
+    return;
+  }
+  switch (s->scheduler)
+  {
+  case SCHEDULER_CALENDAR:
+    cq_remove(s, p);
+    break;
+  case SCHEDULER_FIFO:
+    fifo_remove(s, p);
+    break;
+  default:
+    evheap_remove(s, p);
+  }
+}
+
+/* return the earliest event of the event set, NULL if it is empty */
+static struct event *peekevent(struct sim *s)
+{
+  if (s->evcount == 0)
+    return NULL;
+  switch (s->scheduler)
+  {
+  case SCHEDULER_CALENDAR:
+    return cq_peek(s);
+  case SCHEDULER_FIFO:
+    return fifo_peek(s);
+  default:
+    return s->evheap[0];
+  }
+}
+
+/* remove and return the next event to simulate, NULL if there is none */
+static struct event *nextevent(struct sim *s)
+{
+  struct event *p, *t;
+
+  p = peekevent(s);
+  t = wheel_peek(s);
+  if (t != NULL && (p == NULL || evbefore(t, p)))
+    p = t;
+  if (p != NULL)
+    removeevent(s, p);
+  return p;
+}
+
+/* copy the pending events, in no particular order, into out[] */
+static void getpending(struct sim *s, struct event **out)
+{
+  struct event *q;
+  int i, n;
+
+  n = 0;
+  for (q = s->wheeldue; q != NULL; q = q->next)
+    out[n++] = q;
+  for (i = 0; i <= WHEEL_OVERFLOW; i++)
+    for (q = s->wheelslot[i]; q != NULL; q = q->next)
+      out[n++] = q;
+
+  switch (s->scheduler)
+  {
+  case SCHEDULER_CALENDAR:
+    for (i = 0; i < s->cqnbuckets; i++)
+      for (q = s->cqbucket[i]; q != NULL; q = q->next)
+        out[n++] = q;
+    break;
+  case SCHEDULER_FIFO:
+    for (i = 0; i < s->chanq[A].count; i++)
+      out[n++] = s->chanq[A].slot[(s->chanq[A].head + i) & (s->chanq[A].size - 1)];
+    for (i = 0; i < s->chanq[B].count; i++)
+      out[n++] = s->chanq[B].slot[(s->chanq[B].head + i) & (s->chanq[B].size - 1)];
+    if (s->fifotimer[A] != NULL)
+      out[n++] = s->fifotimer[A];
+    if (s->fifotimer[B] != NULL)
+      out[n++] = s->fifotimer[B];
+    if (s->fifoarrival != NULL)
+      out[n++] = s->fifoarrival;
+    break;
+  default:
+    for (i = 0; i < s->evcount; i++)
+      out[n++] = s->evheap[i];
+  }
+}
+
+static struct event *allocevent(struct sim *s)
+{
+  struct event *p;
+  int i;
+
+  if (s->evfree == NULL)
+  {
+    p = malloc(POOL_SLAB * sizeof(struct event));
+    if (p == 0)
+    {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < POOL_SLAB; i++)
+    {
+      p[i].next = s->evfree;
+      s->evfree = &p[i];
+    }
+    s->slabs = realloc(s->slabs, (s->pool_slabs + 1) * sizeof(struct event *));
+    if (s->slabs == 0)
+    {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
+    }
+    s->slabs[s->pool_slabs++] = p;
+  }
+  p = s->evfree;
+  s->evfree = p->next;
+  if (++s->pool_inuse > s->pool_highwater)
+    s->pool_highwater = s->pool_inuse;
+  return p;
+}
+
+static void freeevent(struct sim *s, struct event *p)
+{
+  p->next = s->evfree;
+  s->evfree = p;
+  s->pool_inuse--;
+}
+
+/********************** CHANNEL RECORD AND REPLAY ***********************/
+static FILE *chan_openfile(struct sim *s, const char *file, const char *mode)
+{
+  char magic[sizeof(CHAN_MAGIC) - 1];
+  FILE *fp;
+
+  fp = fopen(file, mode);
+  if (fp == NULL)
+    sim_fatal(s, "cannot open channel file %s\n", file);
+  if (mode[0] == 'w')
+    fwrite(CHAN_MAGIC, 1, sizeof(magic), fp);
+  else if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, CHAN_MAGIC, sizeof(magic)) != 0)
+    sim_fatal(s, "%s is not a channel file\n", file);
+  return fp;
+}
+
+static struct channel *chan_open(struct sim *s, const char *recordfile, const char *replayfile)
+{
+  struct channel *ch;
+  int i;
+
+  ch = calloc(1, sizeof(struct channel));
+  if (ch == 0)
+  {
+    printf("memory allocation for channel failed.");
+    exit(EXIT_FAILURE);
+  }
+  if (recordfile != NULL)
+    ch->record = chan_openfile(s, recordfile, "wb");
+  if (replayfile != NULL)
+    for (i = 0; i < 3; i++)
+      ch->replay[i] = chan_openfile(s, replayfile, "rb");
+  return ch;
+}
+
+static void chan_close(struct channel *ch)
+{
+  int i;
+
+  if (ch == NULL)
+    return;
+  if (ch->record != NULL)
+    fclose(ch->record);
+  for (i = 0; i < 3; i++)
+    if (ch->replay[i] != NULL)
+      fclose(ch->replay[i]);
+  free(ch);
+}
+
+/* next recorded decision for cursor which (0 arrivals, 1 + sender for */
+/* packets); returns 0, once with a warning, when the file runs out     */
+static int chan_next(struct sim *s, int which, struct chanrecord *c)
+{
+  FILE *fp = s->channel->replay[which];
+
+  if (fp == NULL)
+    return 0;
+  while (fread(c, sizeof(*c), 1, fp) == 1)
+    if (which == 0 ? c->kind == CHAN_ARRIVAL : c->kind == CHAN_PACKET && c->entity == which - 1)
+      return 1;
+  /* to stderr, so that it does not mix with CSV or JSON results */
+  fprintf(stderr, "Warning: channel replay has no more %s; drawing them instead\n",
+          which == 0 ? "arrivals" : which == 1 ? "packets from A" : "packets from B");
+  fclose(fp);
+  s->channel->replay[which] = NULL;
+  return 0;
+}
+
+/* the uniform draw behind the time to the next message from layer 5 */
+static double chan_arrival(struct sim *s)
+{
+  struct channel *ch = s->channel;
+  struct chanrecord c;
+
+  if (ch == NULL)
+    return jimsrand(s, STREAM_ARRIVAL);
+  if (!chan_next(s, 0, &c))
+  {
+    memset(&c, 0, sizeof(c));
+    c.kind = CHAN_ARRIVAL;
+    c.u = jimsrand(s, STREAM_ARRIVAL);
+  }
+  if (ch->record != NULL)
+    fwrite(&c, sizeof(c), 1, ch->record);
+  return c.u;
+}
+
+/* The decisions about a packet from AorB, in the order tolayer3() makes */
+/* them: chan_lost(), then for a packet that is not lost chan_delay() and */
+/* chan_corrupt().  The fate goes to the record file with chan_done().    */
+static int chan_lost(struct sim *s, int AorB)
+{
+  struct channel *ch = s->channel;
+  int lost;
+
+  lost = jimsrand(s, STREAM_LOSS) < s->lossprob &&
+         (!(AorB == B && s->corruptdirection == A) && !(AorB == A && s->corruptdirection == B));
+  if (ch == NULL)
+    return lost;
+  ch->replaying = chan_next(s, 1 + AorB, &ch->cur);
+  if (ch->replaying)
+    return ch->cur.fate == CHAN_LOST;
+  memset(&ch->cur, 0, sizeof(ch->cur));
+  ch->cur.kind = CHAN_PACKET;
+  ch->cur.entity = AorB;
+  ch->cur.fate = lost ? CHAN_LOST : CHAN_INTACT;
+  return lost;
+}
+
+static double chan_delay(struct sim *s)
+{
+  struct channel *ch = s->channel;
+  double u = jimsrand(s, STREAM_DELAY);
+
+  if (ch == NULL)
+    return u;
+  if (!ch->replaying)
+    ch->cur.u = u;
+  return ch->cur.u;
+}
+
+/* CHAN_INTACT, or how the packet is corrupted */
+static int chan_corrupt(struct sim *s, int AorB)
+{
+  struct channel *ch = s->channel;
+  int fate = CHAN_INTACT;
+  double x;
+
+  if ((jimsrand(s, STREAM_CORRUPT) < s->corruptprob) &&
+      (!(AorB == B && s->corruptdirection == A) && !(AorB == A && s->corruptdirection == B)))
+  {
+    if ((x = jimsrand(s, STREAM_CORRUPT)) < .75)
+      fate = CHAN_PAYLOAD;
+    else if (x < .875)
+      fate = CHAN_SEQNUM;
+    else
+      fate = CHAN_ACKNUM;
+  }
+  if (ch == NULL)
+    return fate;
+  if (!ch->replaying)
+    ch->cur.fate = fate;
+  return ch->cur.fate;
+}
+
+static void chan_done(struct sim *s)
+{
+  if (s->channel != NULL && s->channel->record != NULL)
+    fwrite(&s->channel->cur, sizeof(s->channel->cur), 1, s->channel->record);
+}
+
+void generate_next_arrival(struct sim *s)
+{
+  double x;
+  struct event *evptr;
+
+  if (TRACING(s, 3))
+    sim_printf(s, "          GENERATE NEXT ARRIVAL: creating new arrival\n");
+
+  x = s->lambda * chan_arrival(s) * 2; /* x is uniform on [0,2*lambda] */
+  /* having mean of lambda        */
+  evptr = allocevent(s);
+  evptr->evtime = clockround(s, s->time + clockdelay(s, x));
+  evptr->evtype = FROM_LAYER5;
+  if (BIDIRECTIONAL && (jimsrand(s, STREAM_ARRIVAL) > 0.5))
+    evptr->eventity = B;
+  else
+    evptr->eventity = A;
+  insertevent(s, evptr);
+}
+
+static int evcompare(const void *p, const void *q)
+{
+  const struct event *e1 = *(struct event *const *)p;
+  const struct event *e2 = *(struct event *const *)q;
+  if (evbefore(e1, e2))
+    return -1;
+  return evbefore(e2, e1);
+}
+
+void printevlist(struct sim *s)
+{
+  struct event **sorted;
+  int i;
+
+  /* the event set is not kept as one sorted list, so print a sorted copy */
+  sorted = malloc((s->evcount + s->wheelcount + 1) * sizeof(struct event *));
+  if (sorted == 0)
+  {
+    printf("memory allocation for event list failed.");
+    exit(EXIT_FAILURE);
+  }
+  getpending(s, sorted);
+  qsort(sorted, s->evcount + s->wheelcount, sizeof(struct event *), evcompare);
+  sim_printf(s, "--------------\nEvent List Follows:\n");
+  for (i = 0; i < s->evcount + s->wheelcount; i++)
+  {
+    sim_printf(s, "Event time: %f, type: %d entity: %d\n", sorted[i]->evtime, sorted[i]->evtype, sorted[i]->eventity);
+  }
+  sim_printf(s, "--------------\n");
+  free(sorted);
+}
+
+/********************** BINARY EVENT TRACE ***********************/
+static void *rec_map(struct sim *s, struct recorder *r, long long offset, long long length)
+{
+  long long skip = offset % r->pagesize;
+  char *p;
+
+  p = mmap(NULL, length + skip, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, offset - skip);
+  if (p == MAP_FAILED)
+    sim_fatal(s, "cannot map the event trace file.\n");
+  return p + skip;
+}
+
+/* unmap what rec_map() returned as p */
+static void rec_unmap(struct recorder *r, void *p, long long length)
+{
+  long long skip = (uintptr_t)p % r->pagesize;
+
+  munmap((char *)p - skip, length + skip);
+}
+
+/* size the file for nrecords records */
+static void rec_resize(struct sim *s, struct recorder *r, long long nrecords)
+{
+  if (ftruncate(r->fd, EVTRACE_HDRSIZE + nrecords * (long long)sizeof(struct evrecord)) != 0)
+    sim_fatal(s, "cannot extend the event trace file.\n");
+}
+
+/* create the trace file; ring > 0 keeps only the last ring records */
+static struct recorder *rec_open(struct sim *s, const char *file, long long ring)
+{
+  struct recorder *r;
+
+  r = calloc(1, sizeof(struct recorder));
+  if (r == 0)
+  {
+    printf("memory allocation for event trace failed.");
+    exit(EXIT_FAILURE);
+  }
+  r->fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (r->fd < 0)
+    sim_fatal(s, "cannot create event trace file %s\n", file);
+  r->pagesize = sysconf(_SC_PAGESIZE);
+  r->ring = ring > 0;
+  r->nwindow = ring > 0 ? ring : EVTRACE_WINDOW;
+  rec_resize(s, r, r->nwindow);
+  r->header = rec_map(s, r, 0, EVTRACE_HDRSIZE);
+  memcpy(r->header->magic, EVTRACE_MAGIC, sizeof(r->header->magic));
+  r->header->recordsize = sizeof(struct evrecord);
+  r->header->flags = r->ring ? EVTRACE_RING : 0;
+  r->header->capacity = r->ring ? ring : 0;
+  r->window = rec_map(s, r, EVTRACE_HDRSIZE, r->nwindow * sizeof(struct evrecord));
+  return r;
+}
+
+/* the window of a growing trace is full: extend the file and map the next one */
+static void rec_nextwindow(struct sim *s, struct recorder *r)
+{
+  rec_unmap(r, r->window, r->nwindow * sizeof(struct evrecord));
+  r->windowstart += r->nwindow;
+  rec_resize(s, r, r->windowstart + r->nwindow);
+  r->window = rec_map(s, r, EVTRACE_HDRSIZE + r->windowstart * sizeof(struct evrecord),
+                      r->nwindow * sizeof(struct evrecord));
+  r->header->written = r->written;
+}
+
+static void rec_close(struct sim *s, struct recorder *r)
+{
+  if (r == NULL)
+    return;
+  rec_unmap(r, r->window, r->nwindow * sizeof(struct evrecord));
+  if (!r->ring)
+    rec_resize(s, r, r->written); /* drop the unused end of the last window */
+  r->header->written = r->written;
+  rec_unmap(r, r->header, EVTRACE_HDRSIZE);
+  close(r->fd);
+  free(r);
+}
+
+/* append one record; p is the packet involved, NULL if none */
+static void record(struct sim *s, int type, int entity, const struct pkt *p, int flags)
+{
+  struct recorder *r = s->recorder;
+  struct evrecord *e;
+
+  if (r->ring)
+    e = &r->window[r->written % r->nwindow];
+  else
+  {
+    if (r->written - r->windowstart == r->nwindow)
+      rec_nextwindow(s, r);
+    e = &r->window[r->written - r->windowstart];
+  }
+  e->time = s->time;
+  e->seqnum = p != NULL ? p->seqnum : -1;
+  e->acknum = p != NULL ? p->acknum : -1;
+  e->type = type;
+  e->entity = entity;
+  e->flags = flags;
+  r->written++;
+}
+
+/********************** TIME SERIES SAMPLER ***********************/
+#define SAMPLE_BUFSIZE (1 << 20)
+
+static FILE *sample_open(struct sim *s, const char *file)
+{
+  FILE *fp;
+
+  fp = fopen(file, "w");
+  if (fp == NULL)
+    sim_fatal(s, "cannot open sample file %s\n", file);
+  setvbuf(fp, NULL, _IOFBF, SAMPLE_BUFSIZE);
+  fprintf(fp, "time,windowcount,buffered,inflight,delivered\n");
+  return fp;
+}
+
+/* write the samples due up to time t, the time of the next event */
+static void sample(struct sim *s, double t)
+{
+  struct protosample p;
+
+  memset(&p, 0, sizeof(p));
+  A_sample(s, &p);
+  B_sample(s, &p);
+  for (; s->nextsample <= t; s->nextsample += s->sampleinterval)
+    fprintf(s->sampler, "%f,%d,%d,%d,%lld\n", s->nextsample, p.windowcount, p.buffered, s->inflight,
+            s->messages_delivered);
+}
+
+/********************** TRACE OUTPUT ***********************/
+static void *sinkwriter(void *arg)
+{
+  struct tracesink *t = arg;
+  int n;
+
+  pthread_mutex_lock(&t->lock);
+  while (1)
+  {
+    while (t->pending == 0 && !t->stop)
+      pthread_cond_wait(&t->cond, &t->lock);
+    if (t->pending == 0)
+      break;
+    n = t->pending;
+    pthread_mutex_unlock(&t->lock);
+    fwrite(t->buf[!t->active], 1, n, stdout); /* active only changes once pending is 0 */
+    fflush(stdout);
+    pthread_mutex_lock(&t->lock);
+    t->pending = 0;
+    pthread_cond_broadcast(&t->cond);
+  }
+  pthread_mutex_unlock(&t->lock);
+  return NULL;
+}
+
+static struct tracesink *sink_create(void)
+{
+  struct tracesink *t;
+
+  t = calloc(1, sizeof(struct tracesink));
+  if (t == 0 || (t->buf[0] = malloc(TRACE_BUFSIZE)) == 0 || (t->buf[1] = malloc(TRACE_BUFSIZE)) == 0)
+  {
+    fprintf(stderr, "memory allocation for trace output failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&t->lock, NULL);
+  pthread_cond_init(&t->cond, NULL);
+  if (pthread_create(&t->writer, NULL, sinkwriter, t) != 0)
+  {
+    fprintf(stderr, "cannot start trace output thread.\n");
+    exit(EXIT_FAILURE);
+  }
+  return t;
+}
+
+/* pass the buffer being filled to the writer */
+static void sink_handoff(struct tracesink *t)
+{
+  pthread_mutex_lock(&t->lock);
+  while (t->pending != 0)
+    pthread_cond_wait(&t->cond, &t->lock);
+  t->pending = t->len;
+  t->active = !t->active;
+  t->len = 0;
+  pthread_cond_broadcast(&t->cond);
+  pthread_mutex_unlock(&t->lock);
+}
+
+/* wait until everything printed so far has been written */
+static void sink_flush(struct tracesink *t)
+{
+  if (t == NULL)
+    return;
+  if (t->len > 0)
+    sink_handoff(t);
+  pthread_mutex_lock(&t->lock);
+  while (t->pending != 0)
+    pthread_cond_wait(&t->cond, &t->lock);
+  pthread_mutex_unlock(&t->lock);
+}
+
+static void sink_destroy(struct tracesink *t)
+{
+  if (t == NULL)
+    return;
+  sink_flush(t);
+  pthread_mutex_lock(&t->lock);
+  t->stop = 1;
+  pthread_cond_broadcast(&t->cond);
+  pthread_mutex_unlock(&t->lock);
+  pthread_join(t->writer, NULL);
+  pthread_mutex_destroy(&t->lock);
+  pthread_cond_destroy(&t->cond);
+  free(t->buf[0]);
+  free(t->buf[1]);
+  free(t);
+}
+
+/* write out the trace printed so far, then report an error on stderr */
+/* and exit                                                           */
+static void sim_fatal(struct sim *s, const char *format, ...)
+{
+  va_list ap;
+
+  sink_destroy(s->sink);
+  s->sink = NULL;
+  fflush(stdout);
+  va_start(ap, format);
+  vfprintf(stderr, format, ap);
+  va_end(ap);
+  exit(EXIT_FAILURE);
+}
+
+/* write out the trace printed so far, then warn on stderr, away from */
+/* the results on stdout                                              */
+static void sim_warn(struct sim *s, const char *format, ...)
+{
+  va_list ap;
+
+  sink_flush(s->sink);
+  fflush(stdout);
+  va_start(ap, format);
+  vfprintf(stderr, format, ap);
+  va_end(ap);
+}
+
+/* trace n characters as they are, then end the line */
+static void traceline(struct sim *s, const char *p, int n)
+{
+  struct tracesink *t;
+
+  if (s->sink == NULL)
+    s->sink = sink_create();
+  t = s->sink;
+  if (n >= TRACE_BUFSIZE)
+    n = TRACE_BUFSIZE - 1; /* a payload beyond the buffer is cut short */
+  if (t->len + n + 1 > TRACE_BUFSIZE)
+    sink_handoff(t);
+  memcpy(t->buf[t->active] + t->len, p, n);
+  t->buf[t->active][t->len + n] = '\n';
+  t->len += n + 1;
+}
+
+void sim_printf(struct sim *s, const char *format, ...)
+{
+  struct tracesink *t = s->sink;
+  va_list ap;
+  int n;
+
+  if (t == NULL)
+    t = s->sink = sink_create();
+  va_start(ap, format);
+  n = vsnprintf(t->buf[t->active] + t->len, TRACE_BUFSIZE - t->len, format, ap);
+  va_end(ap);
+  if (n >= TRACE_BUFSIZE - t->len && t->len > 0)
+  {
+    /* did not fit: send what is there and format again */
+    sink_handoff(t);
+    va_start(ap, format);
+    n = vsnprintf(t->buf[t->active], TRACE_BUFSIZE, format, ap);
+    va_end(ap);
+  }
+  if (n >= TRACE_BUFSIZE)
+    n = TRACE_BUFSIZE - 1; /* truncated */
+  if (n > 0)
+    t->len += n;
+}
+
+static void init(struct sim *s) /* initialize the simulator */
+{
+  float sum, avg;
+  int i;
+
+  if (s->rng == RNG_XOSHIRO)
+    seedxoshiro(s, s->seed);
+  else
+  {
+    seedrand(s, s->seed); /* init random number generator */
+    sum = 0.0;            /* test random number generator for students */
+    for (i = 0; i < 1000; i++)
+      sum += jimsrand(s, STREAM_ARRIVAL); /* jimsrand() should be uniform in [0,1] */
+    avg = sum / 1000.0;
+    if (avg < 0.25 || avg > 0.75)
+    {
+      printf("It is likely that random number generation on your machine\n");
+      printf("is different from what this emulator expects.  Please take\n");
+      printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  /* initialise statistics */
+  s->stats.window_full = 0;
+  s->stats.total_ACKs_received = 0;
+  s->stats.packets_resent = 0;
+  s->stats.new_ACKs = 0;
+  s->stats.packets_received = 0;
+  s->messages_delivered = 0;
+
+  s->ntolayer3 = 0;
+  s->nlost = 0;
+  s->ncorrupt = 0;
+  s->redelivered = 0;
+  s->unstamped = 0;
+
+  s->time = 0.0; /* initialize time to 0.0 */
+  s->chantail[A] = s->chantail[B] = 0.0;
+  s->cqwidth = 1.0;
+  generate_next_arrival(s); /* initialize event list */
+}
+
+struct sim *sim_create(const struct simconfig *config)
+{
+  struct sim *s;
+
+  s = calloc(1, sizeof(struct sim));
+  if (s == 0)
+  {
+    printf("memory allocation for simulation failed.");
+    exit(EXIT_FAILURE);
+  }
+  s->trace = config->trace;
+  s->nsimmax = config->nsimmax;
+  s->lossprob = config->lossprob;
+  s->corruptprob = config->corruptprob;
+  s->corruptdirection = config->corruptdirection;
+  s->lambda = config->lambda;
+  s->seed = config->seed;
+  s->rng = config->rng;
+  s->clock = config->clock;
+  s->windowsize = config->windowsize;
+  s->msgsize = config->msgsize > 0 ? config->msgsize : MSGSIZE;
+  s->mtu = config->mtu > 0 ? config->mtu : s->msgsize > MSGSIZE ? s->msgsize : MSGSIZE;
+  s->bandwidth = config->bandwidth;
+  if (s->mtu < MSGSIZE || s->msgsize > s->mtu)
+    sim_fatal(s, "the MTU must be at least %d bytes and at least the message size\n", MSGSIZE);
+  if (s->bandwidth < 0)
+    sim_fatal(s, "the bandwidth must not be negative\n");
+  s->pktsize = (sizeof(struct pktbuf) + s->mtu + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+  s->pktperslab = PKT_SLABBYTES / s->pktsize;
+  if (s->pktperslab > POOL_SLAB)
+    s->pktperslab = POOL_SLAB;
+  if (s->pktperslab < 1)
+    s->pktperslab = 1;
+  s->msgdata = malloc(s->msgsize);
+  if (s->msgdata == NULL)
+  {
+    printf("memory allocation for simulation failed.");
+    exit(EXIT_FAILURE);
+  }
+  if (config->tracefile != NULL)
+    s->recorder = rec_open(s, config->tracefile, config->tracering);
+  if (config->chanrecord != NULL || config->chanreplay != NULL)
+    s->channel = chan_open(s, config->chanrecord, config->chanreplay);
+  if (config->samplefile != NULL)
+  {
+    if (config->sampleinterval <= 0)
+      sim_fatal(s, "the sample interval must be positive\n");
+    s->sampler = sample_open(s, config->samplefile);
+    s->sampleinterval = config->sampleinterval;
+  }
+  s->scheduler = config->scheduler;
+  s->usewheel = config->usewheel;
+
+  init(s);
+  A_init(s);
+  B_init(s);
+  return s;
+}
+
+void sim_destroy(struct sim *s)
+{
+  int i;
+
+  for (i = 0; i < s->pool_slabs; i++)
+    free(s->slabs[i]);
+  free(s->slabs);
+  for (i = 0; i < s->pkt_slabs; i++)
+    free(s->pktslabs[i]);
+  free(s->pktslabs);
+  free(s->msgdata);
+  free(s->evheap);
+  free(s->cqbucket);
+  free(s->chanq[A].slot);
+  free(s->chanq[B].slot);
+  free(s->entity[A]);
+  free(s->entity[B]);
+  sink_destroy(s->sink);
+  s->sink = NULL; /* rec_close() may still report an error */
+  rec_close(s, s->recorder);
+  chan_close(s->channel);
+  if (s->sampler != NULL)
+    fclose(s->sampler);
+  free(s);
+}
+
+int sim_trace(const struct sim *s)
+{
+  return s->trace;
+}
+
+int sim_windowsize(const struct sim *s)
+{
+  return s->windowsize;
+}
+
+struct protostats *sim_stats(struct sim *s)
+{
+  return &s->stats;
+}
+
+void *sim_entity(struct sim *s, int AorB)
+{
+  return s->entity[AorB];
+}
+
+void sim_setentity(struct sim *s, int AorB, void *state)
+{
+  s->entity[AorB] = state;
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+/* called by students routine to cancel a previously-started timer */
+void stoptimer(struct sim *s, int AorB)
+/* A or B is trying to stop timer */
+{
+  struct event *q;
+  PROF_BEGIN(STOPTIMER);
+
+  if (TRACING(s, 2))
+    sim_printf(s, "          STOP TIMER: stopping timer at %f\n", s->time);
+  q = s->timerevent[AorB];
+  if (q != NULL)
+  {
+    /* remove this event */
+    removeevent(s, q);
+    freeevent(s, q);
+    s->timerevent[AorB] = NULL;
+  }
+  else
+    sim_warn(s, "Warning: unable to cancel your timer. It wasn't running.\n");
+  PROF_END(s, STOPTIMER);
+}
+
+void starttimer(struct sim *s, int AorB, double increment)
+/* A or B is trying to start timer */
+{
+
+  struct event *evptr;
+  PROF_BEGIN(STARTTIMER);
+
+  if (TRACING(s, 2))
+    sim_printf(s, "          START TIMER: starting timer at %f\n", s->time);
+  /* be nice: check to see if timer is already started, if so, then  warn */
+  if (s->timerevent[AorB] != NULL)
+  {
+    sim_warn(s, "Warning: attempt to start a timer that is already started\n");
+    PROF_END(s, STARTTIMER);
+    return;
+  }
+
+  /* create future event for when timer goes off */
+  evptr = allocevent(s);
+  evptr->evtime = clockround(s, s->time + clockdelay(s, increment));
+  evptr->evtype = TIMER_INTERRUPT;
+
+  evptr->eventity = AorB;
+  insertevent(s, evptr);
+  s->timerevent[AorB] = evptr;
+  PROF_END(s, STARTTIMER);
+}
+
+/********************** DELIVERY LATENCY ***********************/
+static int hist_index(long long v)
+{
+  int e = 0;
+
+  if (v >= (2LL << (HIST_MAXSHIFT + HIST_SUBBITS)))
+    v = (2LL << (HIST_MAXSHIFT + HIST_SUBBITS)) - 1;
+  while ((v >> e) >= 2 * HIST_SUB)
+    e++;
+  return e * HIST_SUB + (int)(v >> e);
+}
+
+/* the largest value counted in bucket i */
+static long long hist_highest(int i)
+{
+  int e = i < 2 * HIST_SUB ? 0 : i / HIST_SUB - 1;
+
+  return ((long long)(i - e * HIST_SUB + 1) << e) - 1;
+}
+
+static void hist_add(struct latencyhist *h, double latency)
+{
+  h->bucket[hist_index((long long)(latency * LATENCY_UNIT))]++;
+  if (h->count++ == 0 || latency > h->max)
+    h->max = latency;
+}
+
+static double hist_percentile(const struct latencyhist *h, double q)
+{
+  long long rank, seen = 0;
+  double v;
+  int i;
+
+  if (h->count == 0)
+    return 0.0;
+  rank = (long long)(q * h->count + 0.999999);
+  if (rank < 1)
+    rank = 1;
+  for (i = 0; i < HIST_SIZE - 1 && (seen += h->bucket[i]) < rank; i++)
+    ;
+  v = (hist_highest(i) + 1) / LATENCY_UNIT;
+  return v < h->max ? v : h->max;
+}
+
+/* A sends the packet in p: stamp its first send; returns whether this */
+/* copy is a resend                                                    */
+static int stamp_send(struct sim *s, struct pktbuf *p)
+{
+  if (s->sending)
+  {
+    p->arrival = s->arrival;
+    s->sending = 0;
+    return 0;
+  }
+  return p->arrival >= 0;
+}
+
+/* a copy of the packet in p reaches B; the first one decides whether */
+/* the message counts as retransmitted                                */
+static void stamp_arrive(struct pktbuf *p, int resent)
+{
+  if (!p->received)
+  {
+    p->received = 1;
+    p->resent = resent;
+  }
+}
+
+/* B delivers the message in p, NULL if the data came from elsewhere */
+static void stamp_deliver(struct sim *s, struct pktbuf *p)
+{
+  if (p == NULL || p->arrival < 0)
+    s->unstamped++;
+  else if (p->delivered)
+    s->redelivered++;
+  else
+  {
+    hist_add(&s->latency[p->resent ? LATENCY_RESENT : LATENCY_FIRST], s->time - p->arrival);
+    p->delivered = 1;
+  }
+}
+
+static void setmark(const struct sim *s, struct mark *m)
+{
+  m->time = s->time;
+  m->nsim = s->nsim;
+  m->delivered = s->messages_delivered;
+  m->window_full = s->stats.window_full;
+  m->resent = s->stats.packets_resent;
+  m->sent[A] = s->nsent[A];
+  m->sent[B] = s->nsent[B];
+}
+
+static double ratio(double x, double y)
+{
+  return y > 0 ? x / y : 0.0;
+}
+
+/* the rates between two marks */
+static void efficiency(const struct mark *from, const struct mark *to, struct efficiency *e)
+{
+  double t = to->time - from->time;
+
+  e->goodput = ratio(to->delivered - from->delivered, t);
+  e->throughput = ratio(to->sent[A] - from->sent[A], t);
+  e->retransmission = ratio(to->resent - from->resent, to->sent[A] - from->sent[A]);
+  e->acks_per_msg = ratio(to->sent[B] - from->sent[B], to->delivered - from->delivered);
+  e->window_full = ratio(to->window_full - from->window_full, to->nsim - from->nsim);
+}
+
+static void latency_summary(const struct latencyhist *h, struct latency *l)
+{
+  l->count = h->count;
+  l->p50 = hist_percentile(h, 0.50);
+  l->p90 = hist_percentile(h, 0.90);
+  l->p99 = hist_percentile(h, 0.99);
+  l->p999 = hist_percentile(h, 0.999);
+  l->max = h->count > 0 ? h->max : 0.0;
+}
+
+/************************** TOLAYER3 ***************/
+/* Packets are handed over without copies.  A packet lives in a        */
+/* reference counted buffer: the arrival event holds one reference, and */
+/* a sender that keeps the packet for resending holds another, so a     */
+/* resend shares the buffer as well.  Only corruption writes to a       */
+/* packet in flight, and it writes to a private copy if the buffer is   */
+/* shared.                                                              */
+static struct pktbuf *pktbuf(const struct pkt *packet)
+{
+  return (struct pktbuf *)((char *)packet - offsetof(struct pktbuf, pkt));
+}
+
+struct pkt *newpacket(struct sim *s)
+{
+  struct pktbuf *p;
+  char *slab;
+  int i;
+
+  if (s->pktfree == NULL)
+  {
+    slab = malloc(s->pktperslab * s->pktsize);
+    s->pktslabs = realloc(s->pktslabs, (s->pkt_slabs + 1) * sizeof(struct pktbuf *));
+    if (slab == NULL || s->pktslabs == NULL)
+    {
+      printf("memory allocation for packet failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < s->pktperslab; i++)
+    {
+      p = (struct pktbuf *)(slab + i * s->pktsize);
+      p->pkt.payload = (char *)(p + 1);
+      p->next = s->pktfree;
+      s->pktfree = p;
+    }
+    s->pktslabs[s->pkt_slabs++] = (struct pktbuf *)slab;
+  }
+  p = s->pktfree;
+  s->pktfree = p->next;
+  p->refs = 1;
+  p->arrival = -1.0;
+  p->received = p->resent = p->delivered = 0;
+  p->pkt.length = 0;
+  return &p->pkt;
+}
+
+struct pkt *sharepacket(const struct pkt *packet)
+{
+  struct pktbuf *p = pktbuf(packet);
+
+  p->refs++;
+  return &p->pkt;
+}
+
+struct pkt *copypacket(struct sim *s, const struct pkt *packet)
+{
+  struct pkt *copy = newpacket(s);
+
+  if (packet->length < 0 || packet->length > s->mtu)
+    sim_fatal(s, "packet of %d bytes does not fit the MTU of %d\n", packet->length, s->mtu);
+  copy->seqnum = packet->seqnum;
+  copy->acknum = packet->acknum;
+  copy->checksum = packet->checksum;
+  copy->length = packet->length;
+  memcpy(copy->payload, packet->payload, packet->length);
+  return copy;
+}
+
+void droppacket(struct sim *s, const struct pkt *packet)
+{
+  struct pktbuf *p = pktbuf(packet);
+
+  if (--p->refs == 0)
+  {
+    p->next = s->pktfree;
+    s->pktfree = p;
+  }
+}
+
+/* send by value: the one copy, into an emulator packet */
+void tolayer3(struct sim *s, int AorB, struct pkt packet)
+{
+  struct pkt *p;
+  PROF_BEGIN(PKTCOPY);
+
+  p = copypacket(s, &packet);
+  PROF_END(s, PKTCOPY);
+  tolayer3_send(s, AorB, p);
+}
+
+void tolayer3_send(struct sim *s, int AorB, struct pkt *mypktptr)
+/* A or B is sending to network  */
+{
+  struct event *evptr;
+  struct pkt *copy;
+  double lastime, delay;
+  int fate, resent = 0;
+  PROF_BEGIN(TOLAYER3);
+
+  if (mypktptr->length < 0 || mypktptr->length > s->mtu)
+    sim_fatal(s, "packet of %d bytes does not fit the MTU of %d\n", mypktptr->length, s->mtu);
+  s->ntolayer3++;
+  s->nsent[AorB]++;
+  if (AorB == A)
+    resent = stamp_send(s, pktbuf(mypktptr));
+
+  /* simulate losses: */
+  if (chan_lost(s, AorB))
+  {
+    s->nlost++;
+    if (TRACING(s, 1))
+      sim_printf(s, "          TOLAYER3: packet being lost\n");
+    if (s->recorder != NULL)
+      record(s, EVREC_SEND, AorB, mypktptr, EVREC_LOST);
+    chan_done(s);
+    droppacket(s, mypktptr);
+    PROF_END(s, TOLAYER3);
+    return;
+  }
+
+  /* create future event for arrival of packet at the other side.  It */
+  /* takes over the sender's reference to the packet */
+  evptr = allocevent(s);
+  if (TRACING(s, 3))
+  {
+    sim_printf(s, "          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
+               mypktptr->acknum, mypktptr->checksum);
+    traceline(s, mypktptr->payload, mypktptr->length);
+  }
+
+  s->inflight++;
+  evptr->evtype = FROM_LAYER3;      /* packet will pop out from layer3 */
+  evptr->eventity = (AorB + 1) % 2; /* event occurs at other entity */
+  evptr->resent = resent;
+  /* finally, compute the arrival time of packet at the other end.
+     medium can not reorder, so make sure packet arrives between 1 and 10
+     time units after the latest arrival time of packets
+     currently in the medium on their way to the destination */
+  lastime = s->time;
+  if (s->chantail[evptr->eventity] > lastime)
+    lastime = s->chantail[evptr->eventity];
+  delay = 9 * chan_delay(s);
+  if (s->bandwidth > 0) /* and the time the payload takes to send */
+    delay += mypktptr->length / s->bandwidth;
+  /* lastime + 1 is rounded on its own, as it was when lastime was a float */
+  evptr->evtime = clockround(s, clockround(s, lastime + 1) + clockdelay(s, delay));
+  s->chantail[evptr->eventity] = evptr->evtime;
+
+  /* simulate corruption, recording the packet as it was sent: */
+  fate = chan_corrupt(s, AorB);
+  chan_done(s);
+  if (s->recorder != NULL)
+    record(s, EVREC_SEND, AorB, mypktptr, fate != CHAN_INTACT ? EVREC_CORRUPT : 0);
+  if (fate != CHAN_INTACT)
+  {
+    s->ncorrupt++;
+    if (pktbuf(mypktptr)->refs > 1)
+    {
+      PROF_BEGIN(PKTCOPY);
+      copy = copypacket(s, mypktptr);
+      pktbuf(copy)->arrival = pktbuf(mypktptr)->arrival;
+      pktbuf(copy)->delivered = pktbuf(mypktptr)->delivered;
+      droppacket(s, mypktptr);
+      mypktptr = copy;
+      PROF_END(s, PKTCOPY);
+    }
+    if (fate == CHAN_PAYLOAD)
+    {
+      if (mypktptr->length > 0) /* corrupt payload, if there is one */
+        mypktptr->payload[0] = 'Z';
+    }
+    else if (fate == CHAN_SEQNUM)
+      mypktptr->seqnum = 999999;
+    else
+      mypktptr->acknum = 999999;
+    if (TRACING(s, 1))
+      sim_printf(s, "          TOLAYER3: packet being corrupted\n");
+  }
+
+  evptr->pkt = mypktptr;
+
+  if (TRACING(s, 3))
+    sim_printf(s, "          TOLAYER3: scheduling arrival on other side\n");
+  insertevent(s, evptr);
+  PROF_END(s, TOLAYER3);
+}
+
+/* deliver data, from the packet buffer p if it is in one */
+static void deliver(struct sim *s, int AorB, const char *datasent, int length, struct pktbuf *p)
+{
+  PROF_BEGIN(TOLAYER5);
+
+  if (TRACING(s, 3))
+  {
+    sim_printf(s, "          TOLAYER5: data received by application at ");
+    if (AorB == A)
+      sim_printf(s, "A: ");
+    else
+      sim_printf(s, "B: ");
+    traceline(s, datasent, length);
+  }
+  s->messages_delivered++;
+  if (AorB == B)
+    stamp_deliver(s, p);
+  if (s->recorder != NULL)
+    record(s, EVREC_DELIVER, AorB, NULL, 0);
+  PROF_END(s, TOLAYER5);
+}
+
+void tolayer5(struct sim *s, int AorB, const char *datasent, int length)
+{
+  deliver(s, AorB, datasent, length, NULL);
+}
 
-/****************************************************************************/
-/* jimsrand(): return a double in range [0,1].  The routine below is used to */
-/* isolate all random number generation in one location.  We assume that the*/
-/* system-supplied rand() function return an int in therange [0,mmm]        */
-/****************************************************************************/
-double jimsrand(void)
+void tolayer5_packet(struct sim *s, int AorB, const struct pkt *packet)
 {
-  double mmm = RAND_MAX; /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
-  double x;
-  x = rand() / mmm; /* x should be uniform in [0,1] */
-  if (TRACE > 3)
-    printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
-  return (x);
+  deliver(s, AorB, packet->payload, packet->length, pktbuf(packet));
 }
 
-/********************* EVENT HANDLINE ROUTINES *******/
-/*  The next set of routines handle the event list   */
-/*****************************************************/
+/********************** TIMER MICROBENCHMARK ***********************/
+/* Models a sender with one timer per packet in flight: BENCH_TIMERS  */
+/* timers are started, nine in ten are cancelled (as if acknowledged) */
+/* and the rest are left to fire.  Each phase is timed separately.    */
+#define BENCH_TIMERS 200000
+#define BENCH_ROUNDS 10
+
+static double wallclock(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
 
-void insertevent(struct event *p)
+static void timerbench_run(const char *name, int sched, int wheel)
 {
-  struct event *q, *qold;
+  struct sim *s;
+  struct event **handle;
+  struct event *p;
+  double t0, tstart = 0.0, tstop = 0.0, tfire = 0.0;
+  int round, i, k, nfired = 0, nstopped = 0;
 
-  if (TRACE > 2)
+  /* a bare simulation: no layer 5 arrivals and no protocol */
+  s = calloc(1, sizeof(struct sim));
+  if (s == 0)
   {
-    printf("            INSERTEVENT: time is %f\n", time);
-    printf("            INSERTEVENT: future time will be %f\n", p->evtime);
+    printf("memory allocation for benchmark failed.");
+    exit(EXIT_FAILURE);
   }
-  q = evlist; /* q points to front of list in which p struct inserted */
-  if (q == NULL)
-  { /* list is empty */
-    evlist = p;
-    p->next = NULL;
-    p->prev = NULL;
+  s->scheduler = sched;
+  s->usewheel = wheel;
+  s->cqwidth = 1.0;
+  seedrand(s, 1);
+  handle = malloc(BENCH_TIMERS * sizeof(struct event *));
+  if (handle == 0)
+  {
+    printf("memory allocation for benchmark failed.");
+    exit(EXIT_FAILURE);
   }
-  else
+
+  for (round = 0; round < BENCH_ROUNDS; round++)
   {
-    for (qold = q; q != NULL && p->evtime > q->evtime; q = q->next)
-      qold = q;
-    if (q == NULL)
-    { /* end of list */
-      qold->next = p;
-      p->prev = qold;
-      p->next = NULL;
-    }
-    else if (q == evlist)
-    { /* front of list */
-      p->next = evlist;
-      p->prev = NULL;
-      p->next->prev = p;
-      evlist = p;
+    t0 = wallclock();
+    for (i = 0; i < BENCH_TIMERS; i++)
+    {
+      p = allocevent(s);
+      p->evtime = s->time + 16.0 + 1000.0 * jimsrand(s, STREAM_DELAY);
+      p->evtype = TIMER_INTERRUPT;
+      p->eventity = A;
+      insertevent(s, p);
+      handle[i] = p;
     }
-    else
-    { /* middle of list */
-      p->next = q;
-      p->prev = q->prev;
-      q->prev->next = p;
-      q->prev = p;
+    tstart += wallclock() - t0;
+
+    /* shuffle so that cancellations hit the timers in random order */
+    for (i = BENCH_TIMERS - 1; i > 0; i--)
+    {
+      k = nextrand(s) % (i + 1);
+      p = handle[i];
+      handle[i] = handle[k];
+      handle[k] = p;
+    }
+    t0 = wallclock();
+    for (i = 0; i < BENCH_TIMERS - BENCH_TIMERS / 10; i++)
+    {
+      removeevent(s, handle[i]);
+      freeevent(s, handle[i]);
+    }
+    tstop += wallclock() - t0;
+    nstopped += i;
+
+    t0 = wallclock();
+    while ((p = nextevent(s)) != NULL)
+    {
+      s->time = p->evtime;
+      freeevent(s, p);
+      nfired++;
     }
+    tfire += wallclock() - t0;
   }
+
+  printf("%-16s start %7.2f Mops/s   stop %7.2f Mops/s   fire %7.2f Mops/s\n", name,
+         (double)BENCH_TIMERS * BENCH_ROUNDS / tstart / 1e6, nstopped / tstop / 1e6, nfired / tfire / 1e6);
+  free(handle);
+  sim_destroy(s);
 }
 
-void generate_next_arrival(void)
+static void timerbench(void)
 {
-  double x;
-  struct event *evptr;
+  printf("timer benchmark: %d timers per round, %d rounds, 90%% cancelled\n", BENCH_TIMERS, BENCH_ROUNDS);
+  timerbench_run("heap", SCHEDULER_HEAP, 0);
+  timerbench_run("calendar", SCHEDULER_CALENDAR, 0);
+  timerbench_run("timing wheel", SCHEDULER_HEAP, 1);
+}
 
-  if (TRACE > 2)
-    printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
+/********************** RANDOM DRAW BENCHMARK ***********************/
+/* The draws tolayer3() makes for one packet: loss, delay, corruption */
+/* and, for one packet in ten, the kind of corruption.                */
+#define BENCH_PACKETS 20000000
 
-  x = lambda * jimsrand() * 2; /* x is uniform on [0,2*lambda] */
-  /* having mean of lambda        */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0)
+static struct sim *randbench_sim(int rng)
+{
+  struct sim *s;
+
+  s = calloc(1, sizeof(struct sim));
+  if (s == 0)
   {
-    printf("memory allocation for event failed.");
+    printf("memory allocation for benchmark failed.");
     exit(EXIT_FAILURE);
   }
-  evptr->evtime = time + x;
-  evptr->evtype = FROM_LAYER5;
-  if (BIDIRECTIONAL && (jimsrand() > 0.5))
-    evptr->eventity = B;
+  s->rng = rng;
+  if (rng == RNG_XOSHIRO)
+    seedxoshiro(s, 1);
   else
-    evptr->eventity = A;
-  insertevent(evptr);
+    seedrand(s, 1);
+  return s;
 }
 
-void printevlist(void)
+static void randbench_report(const char *name, double t, double sum)
 {
-  struct event *q;
-  printf("--------------\nEvent List Follows:\n");
-  for (q = evlist; q != NULL; q = q->next)
-  {
-    printf("Event time: %f, type: %d entity: %d\n", q->evtime, q->evtype, q->eventity);
-  }
-  printf("--------------\n");
+  printf("%-24s %6.2f ns/packet   (checksum %.3f)\n", name, t / BENCH_PACKETS * 1e9, sum / BENCH_PACKETS);
 }
 
-void init(void) /* initialize the simulator */
+static void randbench(void)
 {
-  float sum, avg;
-  int i;
+  unsigned long long x[RAND_STREAMS][4];
+  struct sim *s;
+  double t0, sum, c;
+  int i, k;
 
-  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
-  printf("Enter the number of messages to simulate: ");
-  scanf("%d", &nsimmax);
-  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
-  scanf("%f", &lossprob);
-  printf("Enter packet corruption probability [0.0 for no corruption]:");
-  scanf("%f", &corruptprob);
-  if (lossprob != 0.0 || corruptprob != 0.0)
+  printf("random draw benchmark: %d packets\n", BENCH_PACKETS);
+
+  s = randbench_sim(RNG_COMPAT);
+  sum = 0.0;
+  t0 = wallclock();
+  for (i = 0; i < BENCH_PACKETS; i++)
   {
-    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
-    scanf("%d", &corruptdirection);
-  }
-  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
-  scanf("%f", &lambda);
-  printf("Enter TRACE:");
-  scanf("%d", &TRACE);
-
-  srand(9999); /* init random number generator */
-  sum = 0.0;   /* test random number generator for students */
-  for (i = 0; i < 1000; i++)
-    sum += jimsrand(); /* jimsrand() should be uniform in [0,1] */
-  avg = sum / 1000.0;
-  if (avg < 0.25 || avg > 0.75)
-  {
-    printf("It is likely that random number generation on your machine\n");
-    printf("is different from what this emulator expects.  Please take\n");
-    printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
-    exit(EXIT_FAILURE);
+    sum += jimsrand(s, STREAM_LOSS) + jimsrand(s, STREAM_DELAY);
+    if ((c = jimsrand(s, STREAM_CORRUPT)) < 0.1)
+      sum += jimsrand(s, STREAM_CORRUPT);
   }
+  randbench_report("compat, scalar", wallclock() - t0, sum);
+  sim_destroy(s);
 
-  /* initialise statistics */
-  window_full = 0;
-  total_ACKs_received = 0;
-  packets_resent = 0;
-  new_ACKs = 0;
-  packets_received = 0;
-  packets_lost = 0;
-  packets_corrupt = 0;
-  packets_sent = 0;
-  packets_timeout = 0;
-  messages_delivered = 0;
-
-  ntolayer3 = 0;
-  nlost = 0;
-  ncorrupt = 0;
+  /* one xoshiro256** generator per stream, one number per call */
+  seedsplitmix(x[0], 1);
+  for (k = 1; k < RAND_STREAMS; k++)
+  {
+    memcpy(x[k], x[k - 1], sizeof(x[k]));
+    xoshiro_jump(x[k]);
+  }
+  sum = 0.0;
+  t0 = wallclock();
+  for (i = 0; i < BENCH_PACKETS; i++)
+  {
+    sum += (xoshiro_next(x[STREAM_LOSS]) >> 11) * (1.0 / 9007199254740992.0);
+    sum += (xoshiro_next(x[STREAM_DELAY]) >> 11) * (1.0 / 9007199254740992.0);
+    if ((c = (xoshiro_next(x[STREAM_CORRUPT]) >> 11) * (1.0 / 9007199254740992.0)) < 0.1)
+      sum += (xoshiro_next(x[STREAM_CORRUPT]) >> 11) * (1.0 / 9007199254740992.0);
+  }
+  randbench_report("xoshiro, scalar", wallclock() - t0, sum);
 
-  time = 0.0;              /* initialize time to 0.0 */
-  generate_next_arrival(); /* initialize event list */
+  s = randbench_sim(RNG_XOSHIRO);
+  sum = 0.0;
+  t0 = wallclock();
+  for (i = 0; i < BENCH_PACKETS; i++)
+  {
+    sum += jimsrand(s, STREAM_LOSS) + jimsrand(s, STREAM_DELAY);
+    if ((c = jimsrand(s, STREAM_CORRUPT)) < 0.1)
+      sum += jimsrand(s, STREAM_CORRUPT);
+  }
+  randbench_report("xoshiro, batched", wallclock() - t0, sum);
+  sim_destroy(s);
 }
 
-/********************** Student-callable ROUTINES ***********************/
+/********************** BENCHMARK SUITE ***********************/
+/* Microbenchmarks of the hot paths and whole simulations, one CSV line */
+/* each under the header                                                */
+/*   benchmark,ops,seconds,ops_per_sec,ns_per_op,peak_rss_kb            */
+/* An op is one call for a microbenchmark and one event taken from the  */
+/* event list for a scenario.  Every benchmark runs in a child process  */
+/* of its own, so peak_rss_kb is the peak resident set of that one      */
+/* benchmark.  Columns and names are only ever added, so that the lines */
+/* of two commits can be joined on the benchmark name.                  */
+#define SUITE_OPS 4000000 /* calls per microbenchmark */
+#define SUITE_BATCH 1024  /* calls timed together before their events are discarded */
 
-/* called by students routine to cancel a previously-started timer */
-void stoptimer(int AorB)
-/* A or B is trying to stop timer */
+struct benchcase
 {
-  struct event *q;
+  const char *name;
+  long long (*run)(const struct simconfig *, const struct benchcase *, double *); /* returns ops */
+  int messages;
+  float loss, corrupt;
+  int msgsize; /* of a scenario, 0 for the base configuration's */
+};
 
-  if (TRACE > 1)
-    printf("          STOP TIMER: stopping timer at %f\n", time);
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q = evlist; q != NULL; q = q->next)
-    if ((q->evtype == TIMER_INTERRUPT && q->eventity == AorB))
-    {
-      /* remove this event */
-      if (q->next == NULL && q->prev == NULL)
-        evlist = NULL;          /* remove first and only event on list */
-      else if (q->next == NULL) /* end of list - there is one in front */
-        q->prev->next = NULL;
-      else if (q == evlist)
-      { /* front of list - there must be event after */
-        q->next->prev = NULL;
-        evlist = q->next;
-      }
-      else
-      { /* middle of list */
-        q->next->prev = q->prev;
-        q->prev->next = q->next;
-      }
-      free(q);
-      return;
-    }
-  printf("Warning: unable to cancel your timer. It wasn't running.\n");
+/* a simulation that is not run, with the loss and corruption of the */
+/* benchmark: benchmarks call into it directly                       */
+static struct sim *suite_sim(const struct simconfig *base, const struct benchcase *b, int window)
+{
+  struct simconfig config = *base;
+
+  config.nsimmax = 0;
+  config.lossprob = b->loss;
+  config.corruptprob = b->corrupt;
+  config.corruptdirection = 2;
+  config.trace = TRACE_SILENT;
+  config.windowsize = window;
+  config.tracefile = NULL;
+  config.chanrecord = config.chanreplay = NULL;
+  config.samplefile = NULL;
+  return sim_create(&config);
 }
 
-void starttimer(int AorB, double increment)
-/* A or B is trying to start timer */
+/* throw away the pending events, as if they had happened */
+static void suite_drain(struct sim *s)
 {
+  struct event *p;
 
-  struct event *q;
-  struct event *evptr;
+  while ((p = nextevent(s)) != NULL)
+  {
+    s->time = p->evtime;
+    if (p->evtype == TIMER_INTERRUPT)
+      s->timerevent[p->eventity] = NULL;
+    else if (p->evtype == FROM_LAYER3)
+      droppacket(s, p->pkt);
+    freeevent(s, p);
+  }
+}
 
-  if (TRACE > 1)
-    printf("          START TIMER: starting timer at %f\n", time);
-  /* be nice: check to see if timer is already started, if so, then  warn */
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q = evlist; q != NULL; q = q->next)
-    if ((q->evtype == TIMER_INTERRUPT && q->eventity == AorB))
+/* packet arrivals on both channels, each one 1 to 10 time units after */
+/* the last on its channel as tolayer3() schedules them                 */
+static long long suite_insertevent(const struct simconfig *base, const struct benchcase *b, double *t)
+{
+  struct event *p[SUITE_BATCH];
+  struct sim *s;
+  double tail[2] = {0.0, 0.0};
+  double t0;
+  int n, i;
+
+  s = suite_sim(base, b, 0);
+  *t = 0.0;
+  for (n = 0; n < SUITE_OPS; n += SUITE_BATCH)
+  {
+    for (i = 0; i < SUITE_BATCH; i++)
     {
-      printf("Warning: attempt to start a timer that is already started\n");
-      return;
+      p[i] = allocevent(s);
+      if (tail[i & 1] < s->time)
+        tail[i & 1] = s->time;
+      p[i]->evtime = tail[i & 1] = tail[i & 1] + 1 + 9 * jimsrand(s, STREAM_DELAY);
+      p[i]->evtype = FROM_LAYER3;
+      p[i]->eventity = i & 1;
+      p[i]->pkt = newpacket(s);
     }
+    t0 = wallclock();
+    for (i = 0; i < SUITE_BATCH; i++)
+      insertevent(s, p[i]);
+    *t += wallclock() - t0;
+    suite_drain(s);
+  }
+  sim_destroy(s);
+  return n;
+}
 
-  /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0)
+static long long suite_timers(const struct simconfig *base, const struct benchcase *b, double *t)
+{
+  struct sim *s;
+  double t0;
+  int n;
+
+  s = suite_sim(base, b, 0);
+  t0 = wallclock();
+  for (n = 0; n < SUITE_OPS; n++)
   {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+    starttimer(s, A, 16.0);
+    stoptimer(s, A);
   }
-  evptr->evtime = time + increment;
-  evptr->evtype = TIMER_INTERRUPT;
+  *t = wallclock() - t0;
+  sim_destroy(s);
+  return n;
+}
 
-  evptr->eventity = AorB;
-  insertevent(evptr);
+static long long suite_tolayer3(const struct simconfig *base, const struct benchcase *b, double *t)
+{
+  struct sim *s;
+  struct pkt packet;
+  double t0;
+  int n, i;
+
+  s = suite_sim(base, b, 0);
+  packet.seqnum = 0;
+  packet.acknum = -1;
+  packet.length = s->msgsize;
+  packet.payload = s->msgdata;
+  memset(packet.payload, 'a', packet.length);
+  packet.checksum = ComputeChecksum(packet);
+  *t = 0.0;
+  for (n = 0; n < SUITE_OPS; n += SUITE_BATCH)
+  {
+    t0 = wallclock();
+    for (i = 0; i < SUITE_BATCH; i++)
+      tolayer3(s, A, packet);
+    *t += wallclock() - t0;
+    suite_drain(s);
+  }
+  sim_destroy(s);
+  return n;
 }
 
-/************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
-/* A or B is sending to network  */
+static volatile int suite_sink; /* keeps the checksums from being optimised away */
+
+static long long suite_checksum(const struct simconfig *base, const struct benchcase *b, double *t)
 {
-  struct pkt *mypktptr;
-  struct event *evptr, *q;
-  float lastime, x;
-  int i;
+  struct sim *s;
+  struct pkt packet;
+  double t0;
+  int n, sum = 0;
+
+  s = suite_sim(base, b, 0); /* only for its message */
+  packet.acknum = -1;
+  packet.length = s->msgsize;
+  packet.payload = s->msgdata;
+  memset(packet.payload, 'a', packet.length);
+  t0 = wallclock();
+  for (n = 0; n < SUITE_OPS; n++)
+  {
+    packet.seqnum = n;
+    sum += ComputeChecksum(packet);
+  }
+  *t = wallclock() - t0;
+  suite_sink = sum;
+  sim_destroy(s);
+  return n;
+}
 
-  ntolayer3++;
+/* A's window is filled with SUITE_BATCH packets, and the ACKs of all of */
+/* them are timed; each one slides the window and restarts the timer     */
+static long long suite_areceive(const struct simconfig *base, const struct benchcase *b, double *t)
+{
+  struct pkt *ack[SUITE_BATCH];
+  struct msg message;
+  struct sim *s;
+  double t0;
+  int n, i;
 
-  /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B)))
+  s = suite_sim(base, b, SUITE_BATCH);
+  memset(s->msgdata, 'a', s->msgsize);
+  message.length = s->msgsize;
+  message.data = s->msgdata;
+  *t = 0.0;
+  for (n = 0; n < SUITE_OPS; n += SUITE_BATCH)
   {
-    nlost++;
-    if (TRACE > 0)
-      printf("          TOLAYER3: packet being lost\n");
-    return;
+    for (i = 0; i < SUITE_BATCH; i++)
+    {
+      A_output(s, message);
+      ack[i] = newpacket(s);
+      ack[i]->seqnum = 0;
+      ack[i]->acknum = (n + i) % (SUITE_BATCH + 1); /* A's sequence space is its window + 1 */
+      ack[i]->length = MSGSIZE;
+      memset(ack[i]->payload, '0', MSGSIZE);
+      ack[i]->checksum = PacketChecksum(ack[i]);
+    }
+    t0 = wallclock();
+    for (i = 0; i < SUITE_BATCH; i++)
+      A_receive(s, ack[i]);
+    *t += wallclock() - t0;
+    for (i = 0; i < SUITE_BATCH; i++)
+      droppacket(s, ack[i]);
+    suite_drain(s);
   }
+  sim_destroy(s);
+  return n;
+}
+
+/* packets arrive at B in order, and each is ACKed and delivered */
+static long long suite_breceive(const struct simconfig *base, const struct benchcase *b, double *t)
+{
+  struct pkt *packet[SUITE_BATCH];
+  struct sim *s;
+  double t0;
+  int n, i;
 
-  /* make a copy of the packet student just gave me since he/she may decide */
-  /* to do something with the packet after we return back to him/her */
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0)
+  s = suite_sim(base, b, SUITE_BATCH);
+  *t = 0.0;
+  for (n = 0; n < SUITE_OPS; n += SUITE_BATCH)
   {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+    for (i = 0; i < SUITE_BATCH; i++)
+    {
+      packet[i] = newpacket(s);
+      packet[i]->seqnum = (n + i) % (SUITE_BATCH + 1);
+      packet[i]->acknum = -1;
+      packet[i]->length = s->msgsize;
+      memset(packet[i]->payload, 'a' + (n + i) % 26, s->msgsize);
+      packet[i]->checksum = PacketChecksum(packet[i]);
+    }
+    t0 = wallclock();
+    for (i = 0; i < SUITE_BATCH; i++)
+      B_receive(s, packet[i]);
+    *t += wallclock() - t0;
+    for (i = 0; i < SUITE_BATCH; i++)
+      droppacket(s, packet[i]);
+    suite_drain(s);
   }
-  mypktptr->seqnum = packet.seqnum;
-  mypktptr->acknum = packet.acknum;
-  mypktptr->checksum = packet.checksum;
-  for (i = 0; i < 20; i++)
-    mypktptr->payload[i] = packet.payload[i];
-  if (TRACE > 2)
+  sim_destroy(s);
+  return n;
+}
+
+/* a whole simulation with the protocol's own window */
+static long long suite_scenario(const struct simconfig *base, const struct benchcase *b, double *t)
+{
+  struct simconfig config = *base;
+  struct sim *s;
+  long long n;
+  double t0;
+
+  config.nsimmax = b->messages;
+  config.lossprob = b->loss;
+  config.corruptprob = b->corrupt;
+  config.corruptdirection = 2;
+  if (b->msgsize > 0)
   {
-    printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
-           mypktptr->acknum, mypktptr->checksum);
-    for (i = 0; i < 20; i++)
-      printf("%c", mypktptr->payload[i]);
-    printf("\n");
+    config.msgsize = b->msgsize;
+    config.mtu = 0;
   }
+  config.trace = TRACE_SILENT;
+  config.tracefile = NULL;
+  config.chanrecord = config.chanreplay = NULL;
+  config.samplefile = NULL;
+  t0 = wallclock();
+  s = sim_create(&config);
+  sim_run(s);
+  *t = wallclock() - t0;
+  n = s->nevents;
+  sim_destroy(s);
+  return n;
+}
+
+static const struct benchcase suite[] = {
+    {"micro.insertevent", suite_insertevent, 0, 0.0, 0.0, 0},
+    {"micro.starttimer_stoptimer", suite_timers, 0, 0.0, 0.0, 0},
+    {"micro.tolayer3", suite_tolayer3, 0, 0.1, 0.1, 0},
+    {"micro.ComputeChecksum", suite_checksum, 0, 0.0, 0.0, 0},
+    {"micro.A_receive", suite_areceive, 0, 0.0, 0.0, 0},
+    {"micro.B_receive", suite_breceive, 0, 0.0, 0.0, 0},
+    {"macro.noloss_1M", suite_scenario, 1000000, 0.0, 0.0, 0},
+    {"macro.loss10_1M", suite_scenario, 1000000, 0.1, 0.0, 0},
+    {"macro.loss30_1M", suite_scenario, 1000000, 0.3, 0.0, 0},
+    {"macro.corrupt30_1M", suite_scenario, 1000000, 0.0, 0.3, 0},
+    {"macro.noloss_10M", suite_scenario, 10000000, 0.0, 0.0, 0},
+    {"macro.loss10_corrupt10_10M", suite_scenario, 10000000, 0.1, 0.1, 0},
+    {"macro.noloss_1M_1500B", suite_scenario, 1000000, 0.0, 0.0, 1500},
+    {"macro.loss10_corrupt10_100k_64KB", suite_scenario, 100000, 0.1, 0.1, 65536},
+};
+
+static void suite_run(const struct simconfig *base, const struct benchcase *b)
+{
+  struct rusage ru;
+  double t;
+  long long n;
+  pid_t pid;
+  int status;
 
-  /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0)
+  fflush(stdout); /* or the child writes the parent's buffer again */
+  pid = fork();
+  if (pid < 0)
   {
-    printf("memory allocation for event failed.");
+    fprintf(stderr, "cannot start benchmark %s\n", b->name);
     exit(EXIT_FAILURE);
   }
-  evptr->evtype = FROM_LAYER3;      /* packet will pop out from layer3 */
-  evptr->eventity = (AorB + 1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;         /* save ptr to my copy of packet */
-  /* finally, compute the arrival time of packet at the other end.
-     medium can not reorder, so make sure packet arrives between 1 and 10
-     time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
-  lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q = evlist; q != NULL; q = q->next)
-    if ((q->evtype == FROM_LAYER3 && q->eventity == evptr->eventity))
-      lastime = q->evtime;
-  evptr->evtime = lastime + 1 + 9 * jimsrand();
-
-  /* simulate corruption: */
-  if ((jimsrand() < corruptprob) && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B)))
-  {
-    ncorrupt++;
-    if ((x = jimsrand()) < .75)
-      mypktptr->payload[0] = 'Z'; /* corrupt payload */
-    else if (x < .875)
-      mypktptr->seqnum = 999999;
-    else
-      mypktptr->acknum = 999999;
-    if (TRACE > 0)
-      printf("          TOLAYER3: packet being corrupted\n");
+  if (pid == 0)
+  {
+    n = b->run(base, b, &t);
+    getrusage(RUSAGE_SELF, &ru);
+    printf("%s,%lld,%.6f,%.0f,%.2f,%ld\n", b->name, n, t, n / t, t / n * 1e9, ru.ru_maxrss);
+    exit(EXIT_SUCCESS);
+  }
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+  {
+    fprintf(stderr, "benchmark %s failed\n", b->name);
+    exit(EXIT_FAILURE);
   }
+}
+
+/* the scheduler, timing wheel and generator of base apply to every benchmark */
+static void suitebench(const struct simconfig *base)
+{
+  int i;
+
+  printf("benchmark,ops,seconds,ops_per_sec,ns_per_op,peak_rss_kb\n");
+  for (i = 0; i < (int)(sizeof(suite) / sizeof(suite[0])); i++)
+    suite_run(base, &suite[i]);
+}
 
-  if (TRACE > 2)
-    printf("          TOLAYER3: scheduling arrival on other side\n");
-  insertevent(evptr);
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-s heap|calendar|fifo] [-w] [-g compat|xoshiro] [-C float|double|ticks] [-b timers|rand|suite] [-o text|csv|json] [-f configfile]\n", prog);
+  fprintf(stderr, "          [-n msgs] [-l loss] [-c corrupt] [-d direction] [-a lambda] [-t trace] [-e seed] [-W window]\n");
+  fprintf(stderr, "          [-m msgsize] [-M mtu] [-B bandwidth]\n");
+  fprintf(stderr, "          [-T tracefile [-K records]] [-D chanfile | -R chanfile]\n");
+  fprintf(stderr, "          [-P samplefile [-I interval]] [-S sweepfile [-r seeds] [-j threads]]\n");
+  fprintf(stderr, "  -s  event scheduler used for the pending event set (default heap)\n");
+  fprintf(stderr, "  -w  keep timers in a hierarchical timing wheel\n");
+  fprintf(stderr, "  -g  random number generator: compat reproduces glibc's rand() sequence\n");
+  fprintf(stderr, "      (default), xoshiro gives arrivals, loss, delay and corruption separate streams\n");
+  fprintf(stderr, "  -C  simulation clock: float reproduces the traditional results (default), double\n");
+  fprintf(stderr, "      keeps its precision over long runs of many millions of messages, ticks\n");
+  fprintf(stderr, "      counts whole ticks of 1/65536 time unit so that every time is exact\n");
+  fprintf(stderr, "  -b  run a benchmark and exit: timer start/stop/fire, the random draws of a packet\n");
+  fprintf(stderr, "      with the scalar and the batched generators, or the suite of hot path and whole\n");
+  fprintf(stderr, "      simulation benchmarks as CSV, using the -s, -w, -g and -m given before it\n");
+  fprintf(stderr, "  -o  results format (default text, csv for a sweep)\n");
+  fprintf(stderr, "  -f  read simulation parameters from configfile, key=value fields with the keys\n");
+  fprintf(stderr, "      messages, loss, corrupt, direction, lambda, trace, seed, rng (0 compat, 1 xoshiro),\n");
+  fprintf(stderr, "      window, clock (0 float, 1 double, 2 ticks), msgsize, mtu and bandwidth\n");
+  fprintf(stderr, "  -n -l -c -d -a -t -e -W -m -M -B  set one simulation parameter; a config file or any\n");
+  fprintf(stderr, "      of these skips the interactive questions, the rest default to 1000 msgs, no loss or\n");
+  fprintf(stderr, "      corruption, both directions, lambda 10, no trace, seed 9999 and the protocol's window\n");
+  fprintf(stderr, "  -m  bytes per message (default 20)\n");
+  fprintf(stderr, "  -M  largest payload of a packet, at least 20 (default the message size)\n");
+  fprintf(stderr, "  -B  payload bytes a packet sends per time unit, added to its delay (default none)\n");
+  fprintf(stderr, "  -T  record every event in a binary trace file, see evtrace.h and the evtrace tool\n");
+  fprintf(stderr, "  -K  keep only the last records events in the trace file, as a ring\n");
+  fprintf(stderr, "  -D  record the channel's decisions (arrival times, loss, delay, corruption) in chanfile\n");
+  fprintf(stderr, "  -R  replay the channel's decisions from chanfile instead of drawing them, so runs\n");
+  fprintf(stderr, "      with other protocol parameters see the same arrivals, losses and corruptions\n");
+  fprintf(stderr, "  -P  sample A's window occupancy, B's out of order packets, the packets in flight and\n");
+  fprintf(stderr, "      the messages delivered so far to a CSV file, every interval of simulated time\n");
+  fprintf(stderr, "  -I  simulated time between samples (default 100)\n");
+  fprintf(stderr, "  -S  run every configuration in sweepfile and write the results of each run\n");
+  fprintf(stderr, "  -r  runs per configuration in a sweep, each with its own seed (default 1)\n");
+  fprintf(stderr, "  -j  worker threads for a sweep (default one per online CPU)\n");
+  exit(EXIT_FAILURE);
 }
 
-void tolayer5(int AorB, char datasent[20])
+#ifdef PROFILE
+/* the counters of the profiled scopes, to stderr so that they do not */
+/* mix with CSV or JSON results                                        */
+static void printprofile(const struct sim *s)
 {
+  static const char *name[PROF_POINTS] = {"dispatch", "nextevent", "insertevent", "wheel_advance",
+                                          "packet copy", "tolayer3", "tolayer5", "starttimer", "stoptimer",
+                                          "A_output", "A_input", "B_input", "A_timerinterrupt"};
+  const struct profpoint *p;
   int i;
-  if (TRACE > 2)
+
+  fprintf(stderr, "%-18s %12s %16s %12s\n", "scope", "calls", PROF_UNIT, PROF_UNIT "/call");
+  for (i = 0; i < PROF_POINTS; i++)
   {
-    printf("          TOLAYER5: data received by application at ");
-    if (AorB == A)
-      printf("A: ");
-    else
-      printf("B: ");
-    for (i = 0; i < 20; i++)
-      printf("%c", datasent[i]);
-    printf("\n");
+    p = &s->prof[i];
+    if (p->calls > 0)
+      fprintf(stderr, "%-18s %12lld %16llu %12.1f\n", name[i], p->calls, p->ticks, (double)p->ticks / p->calls);
   }
-  messages_delivered++;
 }
+#endif
 
-int main(void)
+/* run the simulation until no events are left */
+void sim_run(struct sim *s)
 {
   struct event *eventptr;
   struct msg msg2give;
-  struct pkt pkt2give;
-
-  int i, j;
 
-  init();
-  A_init();
-  B_init();
+  int j;
 
   while (1)
   {
-    eventptr = evlist; /* get next event to simulate */
+    PROF_BEGIN(NEXTEVENT);
+    eventptr = nextevent(s); /* get next event to simulate */
+    PROF_END(s, NEXTEVENT);
     if (eventptr == NULL)
-      goto terminate;
-    evlist = evlist->next; /* remove this event from event list */
-    if (evlist != NULL)
-      evlist->prev = NULL;
-    if (TRACE >= 2)
-    {
-      printf("\nEVENT time: %f,", eventptr->evtime);
-      printf("  type: %d", eventptr->evtype);
+    {
+      sink_flush(s->sink); /* so that what follows on stdout comes after the trace */
+      return;
+    }
+    PROF_BEGIN(DISPATCH);
+    if (TRACING(s, 2))
+    {
+      sim_printf(s, "\nEVENT time: %f,", eventptr->evtime);
+      sim_printf(s, "  type: %d", eventptr->evtype);
       if (eventptr->evtype == 0)
-        printf(", timerinterrupt  ");
+        sim_printf(s, ", timerinterrupt  ");
       else if (eventptr->evtype == 1)
-        printf(", fromlayer5 ");
+        sim_printf(s, ", fromlayer5 ");
       else
-        printf(", fromlayer3 ");
-      printf(" entity: %d\n", eventptr->eventity);
+        sim_printf(s, ", fromlayer3 ");
+      sim_printf(s, " entity: %d\n", eventptr->eventity);
     }
-    time = eventptr->evtime; /* update time to next event time */
+    if (s->sampler != NULL && eventptr->evtime >= s->nextsample)
+      sample(s, eventptr->evtime);
+    s->time = eventptr->evtime; /* update time to next event time */
+    s->nevents++;
+    if (s->recorder != NULL)      /* event types are the first EVREC_ types */
+      record(s, eventptr->evtype, eventptr->eventity, eventptr->evtype == FROM_LAYER3 ? eventptr->pkt : NULL, 0);
     if (eventptr->evtype == FROM_LAYER5)
     {
-      if (nsim < nsimmax)
+      if (s->nsim < s->nsimmax)
       {
-        generate_next_arrival(); /* set up future arrival */
+        if (s->nsim == s->nsimmax / WARMUP_FRACTION)
+          setmark(s, &s->mark[MARK_WARM]);
+        if (s->nsim == s->nsimmax - 1)
+          setmark(s, &s->mark[MARK_LAST]);
+        generate_next_arrival(s); /* set up future arrival */
         /* fill in msg to give with string of same letter */
-        j = nsim % 26;
-        for (i = 0; i < 20; i++)
-          msg2give.data[i] = 97 + j;
-        if (TRACE > 2)
+        j = s->nsim % 26;
+        memset(s->msgdata, 97 + j, s->msgsize);
+        msg2give.length = s->msgsize;
+        msg2give.data = s->msgdata;
+        if (TRACING(s, 3))
         {
-          printf("          MAINLOOP: data given to student: ");
-          for (i = 0; i < 20; i++)
-            printf("%c", msg2give.data[i]);
-          printf("\n");
+          sim_printf(s, "          MAINLOOP: data given to student: ");
+          traceline(s, msg2give.data, msg2give.length);
         }
-        nsim++;
+        s->nsim++;
         if (eventptr->eventity == A)
-          A_output(msg2give);
+        {
+          PROF_BEGIN(A_OUTPUT);
+          s->sending = 1;
+          s->arrival = s->time;
+          A_output(s, msg2give);
+          s->sending = 0; /* the window was full */
+          PROF_END(s, A_OUTPUT);
+        }
         else
-          B_output(msg2give);
+          B_output(s, msg2give);
       }
-      else if (TRACE > 2)
-        printf("          FROM_LAYER5: no more messages to send: \n");
+      else if (TRACING(s, 3))
+        sim_printf(s, "          FROM_LAYER5: no more messages to send: \n");
     }
     else if (eventptr->evtype == FROM_LAYER3)
     {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i = 0; i < 20; i++)
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
-      if (eventptr->eventity == A) /* deliver packet by calling */
-        A_input(pkt2give);         /* appropriate entity */
+      s->inflight--;
+      if (eventptr->eventity == A) /* lend the packet to the */
+      {                            /* appropriate entity    */
+        PROF_BEGIN(A_INPUT);
+        A_receive(s, eventptr->pkt);
+        PROF_END(s, A_INPUT);
+      }
       else
-        B_input(pkt2give);
-      free(eventptr->pktptr); /* free the memory for packet */
+      {
+        PROF_BEGIN(B_INPUT);
+        stamp_arrive(pktbuf(eventptr->pkt), eventptr->resent);
+        B_receive(s, eventptr->pkt);
+        PROF_END(s, B_INPUT);
+      }
+      droppacket(s, eventptr->pkt);
     }
     else if (eventptr->evtype == TIMER_INTERRUPT)
     {
+      s->timerevent[eventptr->eventity] = NULL; /* no longer running */
       if (eventptr->eventity == A)
-        A_timerinterrupt();
+      {
+        PROF_BEGIN(A_TIMER);
+        A_timerinterrupt(s);
+        PROF_END(s, A_TIMER);
+      }
       else
-        B_timerinterrupt();
+        B_timerinterrupt(s);
     }
     else
     {
-      printf("INTERNAL PANIC: unknown event type \n");
+      sim_printf(s, "INTERNAL PANIC: unknown event type \n");
+    }
+    freeevent(s, eventptr);
+    PROF_END(s, DISPATCH);
+  }
+}
+
+void sim_report(struct sim *s)
+{
+  struct simresults r;
+
+  sim_results(s, &r);
+  sim_printresults(RESULTS_TEXT, &r);
+}
+
+void sim_results(const struct sim *s, struct simresults *r)
+{
+  struct mark start, end;
+
+  r->config.nsimmax = s->nsimmax;
+  r->config.lossprob = s->lossprob;
+  r->config.corruptprob = s->corruptprob;
+  r->config.corruptdirection = s->corruptdirection;
+  r->config.lambda = s->lambda;
+  r->config.trace = s->trace;
+  r->config.scheduler = s->scheduler;
+  r->config.usewheel = s->usewheel;
+  r->config.seed = s->seed;
+  r->config.rng = s->rng;
+  r->config.clock = s->clock;
+  r->config.windowsize = s->windowsize;
+  r->config.msgsize = s->msgsize;
+  r->config.mtu = s->mtu;
+  r->config.bandwidth = s->bandwidth;
+  r->time = s->time;
+  r->nsim = s->nsim;
+  r->stats = s->stats;
+  r->messages_delivered = s->messages_delivered;
+  r->ntolayer3 = s->ntolayer3;
+  r->nlost = s->nlost;
+  r->ncorrupt = s->ncorrupt;
+  r->pool_highwater = s->pool_highwater;
+  r->pool_slabs = s->pool_slabs;
+  latency_summary(&s->latency[LATENCY_FIRST], &r->latency[LATENCY_FIRST]);
+  latency_summary(&s->latency[LATENCY_RESENT], &r->latency[LATENCY_RESENT]);
+  r->redelivered = s->redelivered;
+  r->unstamped = s->unstamped;
+  memset(&start, 0, sizeof(start));
+  setmark(s, &end);
+  efficiency(&start, &end, &r->overall);
+  efficiency(&s->mark[MARK_WARM], &s->mark[MARK_LAST], &r->steady);
+}
+
+/* the CSV header line; the other formats have none */
+void sim_printheader(int format)
+{
+  if (format == RESULTS_CSV)
+    printf("messages,loss,corrupt,direction,lambda,window,seed,rng,time,nsim,window_full,new_ACKs,total_ACKs_received,"
+           "packets_resent,packets_received,messages_delivered,ntolayer3,nlost,ncorrupt,pool_highwater,pool_slabs,"
+           "first_count,first_p50,first_p90,first_p99,first_p999,first_max,"
+           "resent_count,resent_p50,resent_p90,resent_p99,resent_p999,resent_max,"
+           "goodput,throughput,retransmission_ratio,acks_per_delivered,window_full_rate,"
+           "steady_goodput,steady_throughput,steady_retransmission_ratio,steady_acks_per_delivered,"
+           "steady_window_full_rate,clock,msgsize,mtu,bandwidth,redelivered,unstamped\n");
+}
+
+void sim_printresults(int format, const struct simresults *r)
+{
+  static const char *rngname[] = {"compat", "xoshiro"};
+  static const char *latencyname[] = {"first", "resent"};
+  static const char *effname[] = {"", "steady_"};
+  static const char *clockname[] = {"float", "double", "ticks"};
+  const struct simconfig *c = &r->config;
+  const struct latency *l;
+  const struct efficiency *e;
+  int i;
+
+  if (format == RESULTS_CSV)
+  {
+    printf("%lld,%g,%g,%d,%g,%d,%u,%s,%f,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%d,%d", c->nsimmax, c->lossprob,
+           c->corruptprob, c->corruptdirection, c->lambda, c->windowsize, c->seed, rngname[c->rng], r->time, r->nsim, r->stats.window_full,
+           r->stats.new_ACKs, r->stats.total_ACKs_received, r->stats.packets_resent, r->stats.packets_received,
+           r->messages_delivered, r->ntolayer3, r->nlost, r->ncorrupt, r->pool_highwater, r->pool_slabs);
+    for (i = LATENCY_FIRST; i <= LATENCY_RESENT; i++)
+    {
+      l = &r->latency[i];
+      printf(",%lld,%f,%f,%f,%f,%f", l->count, l->p50, l->p90, l->p99, l->p999, l->max);
+    }
+    for (i = 0; i < 2; i++)
+    {
+      e = i == 0 ? &r->overall : &r->steady;
+      printf(",%f,%f,%f,%f,%f", e->goodput, e->throughput, e->retransmission, e->acks_per_msg, e->window_full);
+    }
+    printf(",%s,%d,%d,%g,%lld,%lld\n", clockname[c->clock], c->msgsize, c->mtu, c->bandwidth, r->redelivered,
+           r->unstamped);
+  }
+  else if (format == RESULTS_JSON)
+  {
+    printf("{\"messages\": %lld, \"loss\": %g, \"corrupt\": %g, \"direction\": %d, \"lambda\": %g, \"window\": %d, "
+           "\"seed\": %u, \"rng\": \"%s\", \"time\": %f, \"nsim\": %lld, \"window_full\": %lld, \"new_ACKs\": %lld, "
+           "\"total_ACKs_received\": %lld, \"packets_resent\": %lld, \"packets_received\": %lld, "
+           "\"messages_delivered\": %lld, \"ntolayer3\": %lld, \"nlost\": %lld, \"ncorrupt\": %lld, "
+           "\"pool_highwater\": %d, \"pool_slabs\": %d",
+           c->nsimmax, c->lossprob, c->corruptprob, c->corruptdirection, c->lambda, c->windowsize, c->seed,
+           rngname[c->rng], r->time,
+           r->nsim, r->stats.window_full, r->stats.new_ACKs, r->stats.total_ACKs_received, r->stats.packets_resent,
+           r->stats.packets_received, r->messages_delivered, r->ntolayer3, r->nlost, r->ncorrupt, r->pool_highwater,
+           r->pool_slabs);
+    for (i = LATENCY_FIRST; i <= LATENCY_RESENT; i++)
+    {
+      l = &r->latency[i];
+      printf(", \"%s_count\": %lld, \"%s_p50\": %f, \"%s_p90\": %f, \"%s_p99\": %f, \"%s_p999\": %f, \"%s_max\": %f",
+             latencyname[i], l->count, latencyname[i], l->p50, latencyname[i], l->p90, latencyname[i], l->p99,
+             latencyname[i], l->p999, latencyname[i], l->max);
+    }
+    for (i = 0; i < 2; i++)
+    {
+      e = i == 0 ? &r->overall : &r->steady;
+      printf(", \"%sgoodput\": %f, \"%sthroughput\": %f, \"%sretransmission_ratio\": %f, "
+             "\"%sacks_per_delivered\": %f, \"%swindow_full_rate\": %f",
+             effname[i], e->goodput, effname[i], e->throughput, effname[i], e->retransmission, effname[i],
+             e->acks_per_msg, effname[i], e->window_full);
+    }
+    printf(", \"clock\": \"%s\", \"msgsize\": %d, \"mtu\": %d, \"bandwidth\": %g, \"redelivered\": %lld, "
+           "\"unstamped\": %lld}\n",
+           clockname[c->clock], c->msgsize, c->mtu, c->bandwidth, r->redelivered, r->unstamped);
+  }
+  else
+  {
+    printf(" Simulator terminated at time %f\n after attempting to send %lld msgs from layer5\n", r->time, r->nsim);
+    printf("number of messages dropped due to full window:  %lld \n", r->stats.window_full);
+    printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %lld \n", r->stats.new_ACKs);
+    printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
+    printf("number of packet resends by A:  %lld \n", r->stats.packets_resent);
+    printf("number of correct packets received at B:  %lld \n", r->stats.packets_received);
+    printf("number of messages delivered to application:  %lld \n", r->messages_delivered);
+    printf("event pool high-water mark:  %d events in %d slab(s) of %d \n", r->pool_highwater, r->pool_slabs, POOL_SLAB);
+    for (i = LATENCY_FIRST; i <= LATENCY_RESENT; i++)
+    {
+      l = &r->latency[i];
+      printf("delivery latency, %s:  %lld msgs  p50 %f  p90 %f  p99 %f  p99.9 %f  max %f \n",
+             i == LATENCY_FIRST ? "sent once" : "retransmitted", l->count, l->p50, l->p90, l->p99, l->p999, l->max);
+    }
+    printf("messages delivered again:  %lld  delivered without a send stamp:  %lld \n",
+           r->redelivered, r->unstamped);
+    for (i = 0; i < 2; i++)
+    {
+      e = i == 0 ? &r->overall : &r->steady;
+      printf("%s:  goodput %f msgs/time  throughput %f pkts/time  retransmission ratio %f  "
+             "ACKs per delivered msg %f  window-full drop rate %f \n",
+             i == 0 ? "whole run" : "steady state", e->goodput, e->throughput, e->retransmission, e->acks_per_msg,
+             e->window_full);
+    }
+    printf("payload:  %d bytes per msg, MTU %d  goodput %f bytes/time  steady state %f bytes/time \n", c->msgsize,
+           c->mtu, r->overall.goodput * c->msgsize, r->steady.goodput * c->msgsize);
+  }
+}
+
+int sim_setconfig(struct simconfig *config, const char *key, double value)
+{
+  if (strcmp(key, "messages") == 0)
+    config->nsimmax = (long long)value;
+  else if (strcmp(key, "loss") == 0)
+    config->lossprob = value;
+  else if (strcmp(key, "corrupt") == 0)
+    config->corruptprob = value;
+  else if (strcmp(key, "direction") == 0)
+    config->corruptdirection = (int)value;
+  else if (strcmp(key, "lambda") == 0)
+    config->lambda = value;
+  else if (strcmp(key, "trace") == 0)
+    config->trace = (int)value;
+  else if (strcmp(key, "seed") == 0)
+  {
+    if (!(value >= 0 && value <= UINT_MAX) || value != (unsigned)value)
+      return 0;
+    config->seed = (unsigned)value;
+  }
+  else if (strcmp(key, "rng") == 0)
+    config->rng = value != 0 ? RNG_XOSHIRO : RNG_COMPAT;
+  else if (strcmp(key, "window") == 0)
+    config->windowsize = (int)value;
+  else if (strcmp(key, "clock") == 0)
+    config->clock = value >= CLOCK_TICKS ? CLOCK_TICKS : value != 0 ? CLOCK_DOUBLE : CLOCK_FLOAT;
+  else if (strcmp(key, "msgsize") == 0)
+    config->msgsize = (int)value;
+  else if (strcmp(key, "mtu") == 0)
+    config->mtu = (int)value;
+  else if (strcmp(key, "bandwidth") == 0)
+    config->bandwidth = value;
+  else
+    return 0;
+  return 1;
+}
+
+/* read the simulation parameters from the user */
+static void readconfig(struct simconfig *config)
+{
+  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
+  printf("Enter the number of messages to simulate: ");
+  scanf("%lld", &config->nsimmax);
+  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+  scanf("%f", &config->lossprob);
+  printf("Enter packet corruption probability [0.0 for no corruption]:");
+  scanf("%f", &config->corruptprob);
+  if (config->lossprob != 0.0 || config->corruptprob != 0.0)
+  {
+    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
+    scanf("%d", &config->corruptdirection);
+  }
+  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
+  scanf("%f", &config->lambda);
+  printf("Enter TRACE:");
+  scanf("%d", &config->trace);
+}
+
+/* read the simulation parameters from a file of key=value fields, any */
+/* number per line, with the keys of sim_setconfig().  Lines starting   */
+/* with '#' are comments.                                               */
+static void readconfigfile(struct simconfig *config, const char *file)
+{
+  char buf[1024], *field, *value, *end;
+  int line = 0;
+  FILE *fp;
+
+  fp = fopen(file, "r");
+  if (fp == NULL)
+  {
+    fprintf(stderr, "cannot open config file %s\n", file);
+    exit(EXIT_FAILURE);
+  }
+  while (fgets(buf, sizeof(buf), fp) != NULL)
+  {
+    line++;
+    field = strtok(buf, " \t\r\n");
+    if (field != NULL && field[0] == '#')
+      continue;
+    for (; field != NULL; field = strtok(NULL, " \t\r\n"))
+    {
+      value = strchr(field, '=');
+      if (value != NULL)
+      {
+        *value++ = '\0';
+        if (sim_setconfig(config, field, strtod(value, &end)) && end != value && *end == '\0')
+          continue;
+      }
+      fprintf(stderr, "%s line %d: bad setting %s\n", file, line, field);
+      exit(EXIT_FAILURE);
+    }
+  }
+  fclose(fp);
+}
+
+/* the configuration key set by a command line flag, NULL if none */
+static const char *optkey(int c)
+{
+  switch (c)
+  {
+  case 'n':
+    return "messages";
+  case 'l':
+    return "loss";
+  case 'c':
+    return "corrupt";
+  case 'd':
+    return "direction";
+  case 'a':
+    return "lambda";
+  case 't':
+    return "trace";
+  case 'e':
+    return "seed";
+  case 'W':
+    return "window";
+  case 'm':
+    return "msgsize";
+  case 'M':
+    return "mtu";
+  case 'B':
+    return "bandwidth";
+  default:
+    return NULL;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  struct simconfig config = {0};
+  struct simresults results;
+  struct sim *s;
+  const char *sweepfile = NULL;
+  const char *key;
+  char *end;
+  int c, nseeds = 1, nthreads = 0, format = -1, headless = 0;
+
+  /* defaults for whatever the flags or a config file leave out */
+  config.nsimmax = 1000;
+  config.corruptdirection = 2;
+  config.lambda = 10.0;
+  config.seed = 9999;
+  config.trace = TRACE_SILENT;
+  config.scheduler = SCHEDULER_HEAP;
+  config.sampleinterval = 100.0;
+  while ((c = getopt(argc, argv, "s:wb:S:r:j:n:l:c:d:a:t:e:W:m:M:B:f:o:g:T:K:D:R:P:I:C:")) != -1)
+  {
+    if ((key = optkey(c)) != NULL)
+    {
+      if (!sim_setconfig(&config, key, strtod(optarg, &end)) || end == optarg || *end != '\0')
+      {
+        fprintf(stderr, "%s: bad value %s for -%c\n", argv[0], optarg, c);
+        usage(argv[0]);
+      }
+      headless = 1;
+    }
+    else if (c == 'f')
+    {
+      readconfigfile(&config, optarg);
+      headless = 1;
+    }
+    else if (c == 'o' && strcmp(optarg, "text") == 0)
+      format = RESULTS_TEXT;
+    else if (c == 'o' && strcmp(optarg, "csv") == 0)
+      format = RESULTS_CSV;
+    else if (c == 'o' && strcmp(optarg, "json") == 0)
+      format = RESULTS_JSON;
+    else if (c == 'g' && strcmp(optarg, "compat") == 0)
+      config.rng = RNG_COMPAT;
+    else if (c == 'g' && strcmp(optarg, "xoshiro") == 0)
+      config.rng = RNG_XOSHIRO;
+    else if (c == 'C' && strcmp(optarg, "float") == 0)
+      config.clock = CLOCK_FLOAT;
+    else if (c == 'C' && strcmp(optarg, "double") == 0)
+      config.clock = CLOCK_DOUBLE;
+    else if (c == 'C' && strcmp(optarg, "ticks") == 0)
+      config.clock = CLOCK_TICKS;
+    else if (c == 'T')
+      config.tracefile = optarg;
+    else if (c == 'K')
+      config.tracering = atoll(optarg);
+    else if (c == 'D')
+      config.chanrecord = optarg;
+    else if (c == 'R')
+      config.chanreplay = optarg;
+    else if (c == 'P')
+      config.samplefile = optarg;
+    else if (c == 'I')
+      config.sampleinterval = atof(optarg);
+    else if (c == 'w')
+      config.usewheel = 1;
+    else if (c == 'S')
+      sweepfile = optarg;
+    else if (c == 'r')
+      nseeds = atoi(optarg);
+    else if (c == 'j')
+      nthreads = atoi(optarg);
+    else if (c == 'b' && strcmp(optarg, "timers") == 0)
+    {
+      timerbench();
+      return EXIT_SUCCESS;
     }
-    free(eventptr);
+    else if (c == 'b' && strcmp(optarg, "rand") == 0)
+    {
+      randbench();
+      return EXIT_SUCCESS;
+    }
+    else if (c == 'b' && strcmp(optarg, "suite") == 0)
+    {
+      suitebench(&config);
+      return EXIT_SUCCESS;
+    }
+    else if (c == 's' && strcmp(optarg, "heap") == 0)
+      config.scheduler = SCHEDULER_HEAP;
+    else if (c == 's' && strcmp(optarg, "calendar") == 0)
+      config.scheduler = SCHEDULER_CALENDAR;
+    else if (c == 's' && strcmp(optarg, "fifo") == 0)
+      config.scheduler = SCHEDULER_FIFO;
+    else
+      usage(argv[0]);
   }
+  if (nseeds < 1 || nthreads < 0)
+    usage(argv[0]);
 
-terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n", time, nsim);
-  printf("number of messages dropped due to full window:  %d \n", window_full);
-  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
-  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
-  printf("number of packet resends by A:  %d \n", packets_resent);
-  printf("number of correct packets received at B:  %d \n", packets_received);
-  printf("number of messages delivered to application:  %d \n", messages_delivered);
+  if (sweepfile != NULL)
+    return sweep(&config, sweepfile, nseeds, nthreads, format < 0 ? RESULTS_CSV : format);
+  if (!headless)
+    readconfig(&config);
+  s = sim_create(&config);
+  sim_run(s);
+  if (format <= RESULTS_TEXT)
+    sim_report(s);
+  else
+  {
+    sim_results(s, &results);
+    sim_printheader(format);
+    sim_printresults(format, &results);
+  }
+#ifdef PROFILE
+  printprofile(s);
+#endif
+  sim_destroy(s);
   return EXIT_SUCCESS;
 }
\ No newline at end of file
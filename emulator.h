@@ -1,42 +1,220 @@
-extern int TRACE;
+/* one simulation run: event list, clock, channel and statistics.  Every */
+/* routine below takes the simulation it acts on as its first argument.  */
+struct sim;
 
-/* statistics updated by GBN */
-extern int total_ACKs_received;
-extern int packets_resent;   /* count of the number of packets resent  */
-extern int new_ACKs;         /* count of the number of acks correctly received */
-extern int packets_received; /* count of the packets received by receiver */
-extern int window_full;      /* count of the number of messages dropped due to full window */
+/* statistics updated by SR, 64 bits wide for long runs */
+struct protostats
+{
+  long long total_ACKs_received;
+  long long packets_resent;   /* count of the number of packets resent  */
+  long long new_ACKs;         /* count of the number of acks correctly received */
+  long long packets_received; /* count of the packets received by receiver */
+  long long window_full;      /* count of the number of messages dropped due to full window */
+};
+
+/* protocol state the emulator samples over time, see A_sample() and B_sample() */
+struct protosample
+{
+  int windowcount; /* packets in A's window, sent but not yet acknowledged */
+  int buffered;    /* packets B holds out of order */
+};
 
 #define A 0
 #define B 1
 
+/* size of a message unless the simulation sets another, the size of the */
+/* traditional fixed format.  The MTU is never below it.                 */
+#define MSGSIZE 20
+
 /* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
 /* 4 (students' code).  It contains the data (characters) to be delivered */
-/* to layer 5 via the students transport level protocol entities.         */
+/* to layer 5 via the students transport level protocol entities.  The    */
+/* data belongs to the emulator and is only valid during the call.        */
 struct msg
 {
-  char data[20];
+  int length; /* bytes of data, at most the MTU */
+  const char *data;
 };
 
 /* a packet is the data unit passed from layer 4 (students code) to layer */
 /* 3 (teachers code).  Note the pre-defined packet structure, which all   */
-/* students must follow. */
+/* students must follow.  The payload of an emulator packet has room for  */
+/* the MTU; copy packets with copypacket(), not by assignment.            */
 struct pkt
 {
   int seqnum;
   int acknum;
   int checksum;
-  char payload[20];
+  int length; /* bytes of payload, at most the MTU */
+  char *payload;
 };
 
 /* send to A or B (int), packet to send */
-extern void tolayer3(int, struct pkt);
+extern void tolayer3(struct sim *, int, struct pkt);
+
+/* the same without copies.  Emulator packets are reference counted:   */
+/* newpacket() returns a packet holding one reference, sharepacket()    */
+/* adds one, droppacket() gives one up and tolayer3_send() hands one    */
+/* over as sent to A or B (int).  A packet with other references must   */
+/* not be changed.  Packets lent to A_receive() and B_receive() are    */
+/* emulator packets: they may only be read, but may be kept with        */
+/* sharepacket().  copypacket() returns a new emulator packet with the  */
+/* same header and payload.                                             */
+extern struct pkt *newpacket(struct sim *);
+extern struct pkt *sharepacket(const struct pkt *);
+extern struct pkt *copypacket(struct sim *, const struct pkt *);
+extern void droppacket(struct sim *, const struct pkt *);
+extern void tolayer3_send(struct sim *, int, struct pkt *);
 
-/* deliver to A or B (int), data to deliver */
-extern void tolayer5(int, char[20]);
+/* deliver to A or B (int), data to deliver, its length */
+extern void tolayer5(struct sim *, int, const char *, int);
+
+/* deliver to A or B (int) the payload of an emulator packet; at B the */
+/* emulator then knows the message and measures its latency           */
+extern void tolayer5_packet(struct sim *, int, const struct pkt *);
 
 /* start timer at A or B (int), increment */
-extern void starttimer(int, double);
+extern void starttimer(struct sim *, int, double);
 
 /* stop timer at A or B (int) */
-extern void stoptimer(int);
+extern void stoptimer(struct sim *, int);
+
+/* TRACE level of the simulation */
+extern int sim_trace(const struct sim *);
+
+/* Trace levels above TRACE_MAX are compiled out: build with               */
+/* -DTRACE_MAX=-1 for a release binary that carries no tracing at all, or  */
+/* with -DTRACE_MAX=0 to keep only the level 0 messages.  Test with        */
+/* TRACING(s, level), which is true if TRACE >= level.  TRACING(s, 0)      */
+/* messages are printed at any TRACE entered; TRACE_SILENT, the default    */
+/* of runs set up by flags, sweeps and benchmarks, turns them off too.     */
+#ifndef TRACE_MAX
+#define TRACE_MAX 4
+#endif
+#define TRACING(s, level) ((level) <= TRACE_MAX && sim_trace(s) >= (level))
+#define TRACE_SILENT -1
+
+/* printf() for trace output and warnings.  Output is buffered per */
+/* simulation and written to stdout by a separate thread.          */
+extern void sim_printf(struct sim *, const char *, ...);
+
+/* window size the protocol should use, 0 for its own default */
+extern int sim_windowsize(const struct sim *);
+
+/* statistics the protocol updates */
+extern struct protostats *sim_stats(struct sim *);
+
+/* protocol state kept for A or B (int); it must come from malloc() and */
+/* is freed with the simulation */
+extern void *sim_entity(struct sim *, int);
+extern void sim_setentity(struct sim *, int, void *);
+
+/********************** simulation driver ***********************/
+
+/* event schedulers */
+#define SCHEDULER_HEAP 0
+#define SCHEDULER_CALENDAR 1
+#define SCHEDULER_FIFO 2
+
+/* random number generators */
+#define RNG_COMPAT 0  /* one sequence, the one glibc's rand() gives */
+#define RNG_XOSHIRO 1 /* xoshiro256**, a separate stream per kind of draw */
+
+/* simulation clocks.  CLOCK_FLOAT rounds every time to a float, which */
+/* reproduces the emulator's traditional results; beyond a few million */
+/* messages it runs out of precision and events collapse onto the same */
+/* time.  CLOCK_DOUBLE keeps full double precision for long runs.      */
+/* CLOCK_TICKS counts time in integer ticks: every delay is truncated   */
+/* to whole ticks, so all times are exact and events are ordered the    */
+/* same on every platform and compiler.                                 */
+#define CLOCK_FLOAT 0
+#define CLOCK_DOUBLE 1
+#define CLOCK_TICKS 2
+
+struct simconfig
+{
+  long long nsimmax;    /* number of msgs to generate, then stop */
+  float lossprob;       /* probability that a packet is dropped  */
+  float corruptprob;    /* probability that one bit is packet is flipped */
+  int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
+  float lambda;         /* arrival rate of messages from layer 5 */
+  int trace;            /* TRACE level */
+  int scheduler;        /* SCHEDULER_HEAP, SCHEDULER_CALENDAR or SCHEDULER_FIFO */
+  int usewheel;         /* keep timers in a timing wheel */
+  unsigned seed;        /* random number generator seed */
+  int rng;              /* RNG_COMPAT or RNG_XOSHIRO */
+  int clock;            /* CLOCK_FLOAT, CLOCK_DOUBLE or CLOCK_TICKS */
+  int windowsize;       /* protocol window size, 0 = protocol default */
+  int msgsize;          /* bytes per message, 0 = MSGSIZE */
+  int mtu;              /* largest packet payload, 0 = the message size or MSGSIZE */
+  double bandwidth;     /* payload bytes per time unit a packet takes to send, */
+                        /* 0 = delay independent of size */
+  const char *tracefile; /* binary event trace written here, NULL for none */
+  long long tracering;   /* records kept in the trace file, 0 for all */
+  const char *chanrecord; /* channel decisions recorded here, NULL for none */
+  const char *chanreplay; /* channel decisions replayed from here, NULL for none */
+  const char *samplefile; /* protocol state sampled to this CSV file, NULL for none */
+  double sampleinterval;  /* simulated time between samples */
+};
+
+/* set the field of a configuration named by key: messages, loss, */
+/* corrupt, direction, lambda, trace, seed, rng, window, clock,    */
+/* msgsize, mtu or bandwidth.  Returns 0 if the key is unknown, or */
+/* for a seed that is not a whole number in the range of unsigned. */
+extern int sim_setconfig(struct simconfig *, const char *, double);
+
+/* end-to-end delay of the messages delivered to layer 5 at B, from   */
+/* their arrival from layer 5 at A, in simulated time.  Percentiles are */
+/* within 1% of the exact value.                                      */
+#define LATENCY_FIRST 0  /* delivered from the first transmission */
+#define LATENCY_RESENT 1 /* A had to send the packet again */
+
+struct latency
+{
+  long long count; /* messages delivered */
+  double p50, p90, p99, p999, max;
+};
+
+/* rates over the whole run, and over its steady state: from the arrival */
+/* of the first tenth of the messages to the arrival of the last one, */
+/* without the warm-up and the drain after the last message            */
+struct efficiency
+{
+  double goodput;        /* messages delivered per unit of simulated time */
+  double throughput;     /* packets A sent into layer 3 per unit of time */
+  double retransmission; /* packets resent / packets A sent */
+  double acks_per_msg;   /* packets B sent per message delivered */
+  double window_full;    /* messages dropped at a full window / messages from layer 5 */
+};
+
+/* counters at the end of a run */
+struct simresults
+{
+  struct simconfig config; /* the configuration that was run */
+  double time;             /* simulated time at termination */
+  long long nsim;          /* msgs generated at layer 5 */
+  struct protostats stats; /* statistics updated by the protocol */
+  long long messages_delivered; /* msgs delivered to layer 5 */
+  long long ntolayer3;          /* packets sent into layer 3 */
+  long long nlost;              /* packets lost in the medium */
+  long long ncorrupt;           /* packets corrupted by the medium */
+  int pool_highwater;      /* most events allocated at once */
+  int pool_slabs;          /* event pool slabs allocated */
+  struct latency latency[2]; /* LATENCY_FIRST, LATENCY_RESENT */
+  long long redelivered;     /* msgs delivered at B again, without a latency */
+  long long unstamped;       /* msgs delivered at B without a send stamp */
+  struct efficiency overall, steady;
+};
+
+/* output formats of sim_printresults() */
+#define RESULTS_TEXT 0 /* the prose report */
+#define RESULTS_CSV 1  /* a header line, then one line per run */
+#define RESULTS_JSON 2 /* one JSON object per line and run */
+
+extern struct sim *sim_create(const struct simconfig *);
+extern void sim_run(struct sim *);
+extern void sim_report(struct sim *);
+extern void sim_results(const struct sim *, struct simresults *);
+extern void sim_printheader(int);
+extern void sim_printresults(int, const struct simresults *);
+extern void sim_destroy(struct sim *);
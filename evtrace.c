@@ -0,0 +1,231 @@
+/* evtrace.c */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "evtrace.h"
+
+/* ******************************************************************
+   Reader for the binary event traces written by "sr -T file".  Prints
+   the records that pass the filters, or with -s only a summary of them.
+
+   The file is mapped rather than read, and records are visited in the
+   order they were written, so a multi-GB trace is paged through once
+   without being loaded into memory.  For a ring the oldest record kept
+   is record written - capacity.
+
+   Build with:  make evtrace, or gcc -O2 evtrace.c -o evtrace
+**********************************************************************/
+
+static const char *typename[EVREC_TYPES] = {"timer", "layer5", "layer3", "send", "deliver"};
+
+/* what a record must match; -1 or a negative time bound matches anything */
+struct filter
+{
+  int type;
+  int entity;
+  int seqnum;
+  int acknum;
+  int flags;    /* all these flags must be set */
+  double from;  /* first time, inclusive */
+  double until; /* last time, inclusive */
+};
+
+struct summary
+{
+  long long matched;
+  long long bytype[EVREC_TYPES];
+  long long lost, corrupt;
+  double first, last;
+};
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [-t type] [-e A|B] [-q seqnum] [-k acknum] [-L] [-C] [-b from] [-u until] [-s] tracefile\n",
+         prog);
+  printf("  -t  only records of this type: timer, layer5, layer3, send or deliver\n");
+  printf("  -e  only records of entity A or B\n");
+  printf("  -q  only records of packets with this sequence number\n");
+  printf("  -k  only records of packets with this acknowledgement number\n");
+  printf("  -L  only packets the medium lost\n");
+  printf("  -C  only packets the medium corrupted\n");
+  printf("  -b  only records at or after this simulated time\n");
+  printf("  -u  only records at or before this simulated time\n");
+  printf("  -s  print a summary of the matching records instead of the records\n");
+  exit(EXIT_FAILURE);
+}
+
+static int matches(const struct evrecord *e, const struct filter *f)
+{
+  if (f->type >= 0 && e->type != f->type)
+    return 0;
+  if (f->entity >= 0 && e->entity != f->entity)
+    return 0;
+  if (f->seqnum != -1 && e->seqnum != f->seqnum)
+    return 0;
+  if (f->acknum != -1 && e->acknum != f->acknum)
+    return 0;
+  if ((e->flags & f->flags) != f->flags)
+    return 0;
+  if (f->from >= 0 && e->time < f->from)
+    return 0;
+  if (f->until >= 0 && e->time > f->until)
+    return 0;
+  return 1;
+}
+
+static void printrecord(const struct evrecord *e)
+{
+  printf("%f %-7s %c", e->time, e->type < EVREC_TYPES ? typename[e->type] : "?", e->entity == 0 ? 'A' : 'B');
+  if (e->seqnum != -1 || e->acknum != -1)
+    printf(" seq %d ack %d", e->seqnum, e->acknum);
+  if (e->flags & EVREC_LOST)
+    printf(" lost");
+  if (e->flags & EVREC_CORRUPT)
+    printf(" corrupt");
+  printf("\n");
+}
+
+static void count(struct summary *sum, const struct evrecord *e)
+{
+  if (sum->matched++ == 0)
+    sum->first = e->time;
+  sum->last = e->time;
+  if (e->type < EVREC_TYPES)
+    sum->bytype[e->type]++;
+  if (e->flags & EVREC_LOST)
+    sum->lost++;
+  if (e->flags & EVREC_CORRUPT)
+    sum->corrupt++;
+}
+
+static void printsummary(const struct summary *sum, unsigned long long nrecords)
+{
+  long long sent = sum->bytype[EVREC_SEND];
+  int i;
+
+  printf("records in trace:  %llu\n", nrecords);
+  printf("records matched:  %lld\n", sum->matched);
+  if (sum->matched > 0)
+    printf("simulated time:  %f to %f\n", sum->first, sum->last);
+  for (i = 0; i < EVREC_TYPES; i++)
+    printf("  %-8s %lld\n", typename[i], sum->bytype[i]);
+  printf("packets lost:  %lld", sum->lost);
+  if (sent > 0)
+    printf(" (%.4f of sent)", (double)sum->lost / sent);
+  printf("\npackets corrupted:  %lld", sum->corrupt);
+  if (sent > 0)
+    printf(" (%.4f of sent)", (double)sum->corrupt / sent);
+  printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+  struct filter f = {-1, -1, -1, -1, 0, -1.0, -1.0};
+  struct summary sum;
+  const struct evtraceheader *h;
+  const struct evrecord *rec, *e;
+  unsigned long long nrecords, first, capacity, i, j;
+  struct stat st;
+  int c, fd, summarize = 0;
+  char *map;
+
+  while ((c = getopt(argc, argv, "t:e:q:k:LCb:u:s")) != -1)
+  {
+    if (c == 't')
+    {
+      for (f.type = 0; f.type < EVREC_TYPES && strcmp(optarg, typename[f.type]) != 0; f.type++)
+        ;
+      if (f.type == EVREC_TYPES)
+        usage(argv[0]);
+    }
+    else if (c == 'e' && (optarg[0] == 'A' || optarg[0] == 'B'))
+      f.entity = optarg[0] - 'A';
+    else if (c == 'q')
+      f.seqnum = atoi(optarg);
+    else if (c == 'k')
+      f.acknum = atoi(optarg);
+    else if (c == 'L')
+      f.flags |= EVREC_LOST;
+    else if (c == 'C')
+      f.flags |= EVREC_CORRUPT;
+    else if (c == 'b')
+      f.from = atof(optarg);
+    else if (c == 'u')
+      f.until = atof(optarg);
+    else if (c == 's')
+      summarize = 1;
+    else
+      usage(argv[0]);
+  }
+  if (optind != argc - 1)
+    usage(argv[0]);
+
+  fd = open(argv[optind], O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0)
+  {
+    printf("cannot open %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  if (st.st_size < EVTRACE_HDRSIZE)
+  {
+    printf("%s is not an event trace\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    printf("cannot map %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  h = (const struct evtraceheader *)map;
+  if (memcmp(h->magic, EVTRACE_MAGIC, sizeof(h->magic)) != 0 || h->recordsize != sizeof(struct evrecord))
+  {
+    printf("%s is not an event trace of this version\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+
+  /* records actually in the file, and where the oldest one is */
+  rec = (const struct evrecord *)(map + EVTRACE_HDRSIZE);
+  capacity = (st.st_size - EVTRACE_HDRSIZE) / sizeof(struct evrecord);
+  if (h->flags & EVTRACE_RING)
+  {
+    if (h->capacity > capacity)
+    {
+      printf("%s is truncated\n", argv[optind]);
+      return EXIT_FAILURE;
+    }
+    capacity = h->capacity;
+    nrecords = h->written < capacity ? h->written : capacity;
+    first = h->written < capacity ? 0 : h->written % capacity;
+  }
+  else
+  {
+    nrecords = h->written < capacity ? h->written : capacity;
+    first = 0;
+  }
+
+  memset(&sum, 0, sizeof(sum));
+  for (i = 0, j = first; i < nrecords; i++, j++)
+  {
+    if (j == capacity)
+      j = 0;
+    e = &rec[j];
+    if (!matches(e, &f))
+      continue;
+    if (summarize)
+      count(&sum, e);
+    else
+      printrecord(e);
+  }
+  if (summarize)
+    printsummary(&sum, nrecords);
+
+  munmap(map, st.st_size);
+  close(fd);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+// evtrace.h
+/* Binary event trace.  A trace file is a header block followed by fixed */
+/* width records, one per simulated event.  A ring trace keeps the last  */
+/* capacity records: record i is stored in slot i % capacity.            */
+#include <stdint.h>
+
+#define EVTRACE_MAGIC "SREVTR01"
+#define EVTRACE_HDRSIZE 4096 /* records start 4 KiB into the file, whatever the page size */
+#define EVTRACE_RING 1       /* header flag: records wrap around */
+
+struct evtraceheader
+{
+  char magic[8];       /* EVTRACE_MAGIC, not NUL terminated */
+  uint32_t recordsize; /* sizeof(struct evrecord) */
+  uint32_t flags;      /* EVTRACE_RING */
+  uint64_t capacity;   /* records a ring holds, 0 if not a ring */
+  uint64_t written;    /* records written in total */
+};
+
+/* record types.  The first three are events taken from the event list. */
+#define EVREC_TIMER 0   /* timer interrupt at entity */
+#define EVREC_LAYER5 1  /* message from layer 5 at entity */
+#define EVREC_LAYER3 2  /* packet arrives at entity */
+#define EVREC_SEND 3    /* entity hands a packet to layer 3 */
+#define EVREC_DELIVER 4 /* entity delivers data to layer 5 */
+#define EVREC_TYPES 5
+
+/* record flags */
+#define EVREC_LOST 1    /* the medium drops the packet */
+#define EVREC_CORRUPT 2 /* the medium corrupts the packet */
+
+struct evrecord
+{
+  double time;    /* simulated time */
+  int32_t seqnum; /* packet fields, -1 if there is no packet */
+  int32_t acknum;
+  uint8_t type;   /* EVREC_ */
+  uint8_t entity; /* A or B */
+  uint8_t flags;  /* EVREC_LOST, EVREC_CORRUPT */
+  uint8_t unused[5];
+};
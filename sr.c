@@ -1,6 +1,7 @@
 /* sr.c */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdbool.h>
 #include "emulator.h"
 #include "sr.h"
@@ -25,229 +26,321 @@
 
 #define RTT 16.0      /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
 #define WINDOWSIZE 6  /* the maximum number of buffered unacked packet \
-                        MUST BE SET TO 6 when submitting assignment */
-#define SEQSPACE 7    /* the min sequence space for GBN must be at least windowsize + 1 */
+                        MUST BE SET TO 6 when submitting assignment.  Used \
+                        unless the simulation asks for another window */
 #define NOTINUSE (-1) /* used to fill header fields that are not being used */
+#define ACKSIZE 20    /* an ACK carries this many '0's, as in the fixed size format */
 
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
 */
-static int ComputeChecksum(struct pkt packet)
+int PacketChecksum(const struct pkt *packet)
 {
-  int checksum = packet.seqnum + packet.acknum;
-  for (int i = 0; i < 20; i++)
-    checksum += (int)(packet.payload[i]);
+  int checksum = packet->seqnum + packet->acknum;
+  for (int i = 0; i < packet->length; i++)
+    checksum += (int)(packet->payload[i]);
   return checksum;
 }
 
-static bool IsCorrupted(struct pkt packet)
+int ComputeChecksum(struct pkt packet)
 {
-  return packet.checksum != ComputeChecksum(packet);
+  return PacketChecksum(&packet);
 }
 
-/********* Sender (A) variables and procedures ************/
-static struct pkt buffer[WINDOWSIZE];
-static bool acked[WINDOWSIZE];
-static int windowfirst, windowlast;
-static int windowcount;
-static int A_nextseqnum;
-
-void A_init(void)
-{
-  A_nextseqnum = 0;
-  windowfirst = 0;
-  windowlast = -1;
-  windowcount = 0;
-  for (int i = 0; i < WINDOWSIZE; i++)
-    acked[i] = false;
+static bool IsCorrupted(const struct pkt *packet)
+{
+  return packet->checksum != PacketChecksum(packet);
 }
 
-void A_output(struct msg message)
+
+/********* Sender (A) variables and procedures ************/
+/* kept per simulation, see sim_setentity() */
+struct sender
+{
+  struct pkt **buffer; /* windowsize packets held by A, allocated behind the struct */
+  bool *acked;
+  int windowsize;
+  int seqspace; /* the min sequence space for GBN must be at least windowsize + 1 */
+  int windowfirst, windowlast;
+  int windowcount;
+  int A_nextseqnum;
+};
+
+void A_init(struct sim *s)
 {
-  struct pkt sendpkt;
-  int i;
+  int w = sim_windowsize(s) > 0 ? sim_windowsize(s) : WINDOWSIZE;
+  struct sender *a = malloc(sizeof(struct sender) + w * (sizeof(struct pkt *) + sizeof(bool)));
 
-  if (windowcount < WINDOWSIZE)
+  if (a == NULL)
   {
-    if (TRACE > 1)
-      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
+    printf("memory allocation for sender failed.");
+    exit(EXIT_FAILURE);
+  }
+  sim_setentity(s, A, a);
+  a->buffer = (struct pkt **)(a + 1);
+  a->acked = (bool *)(a->buffer + w);
+  a->windowsize = w;
+  a->seqspace = w + 1;
+  a->A_nextseqnum = 0;
+  a->windowfirst = 0;
+  a->windowlast = -1;
+  a->windowcount = 0;
+  for (int i = 0; i < w; i++)
+    a->acked[i] = false;
+}
 
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for (i = 0; i < 20; i++)
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt);
+void A_output(struct sim *s, struct msg message)
+{
+  struct sender *a = sim_entity(s, A);
+  struct pkt *sendpkt;
 
-    windowlast = (windowlast + 1) % WINDOWSIZE;
-    buffer[windowlast] = sendpkt;
-    acked[windowlast] = false;
-    windowcount++;
+  if (a->windowcount < a->windowsize)
+  {
+    if (TRACING(s, 2))
+      sim_printf(s, "----A: New message arrives, send window is not full, send new messge to layer3!\n");
 
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3(A, sendpkt);
+    /* A keeps the packet for resending and sends it shared */
+    a->windowlast = (a->windowlast + 1) % a->windowsize;
+    sendpkt = a->buffer[a->windowlast] = newpacket(s);
+    sendpkt->seqnum = a->A_nextseqnum;
+    sendpkt->acknum = NOTINUSE;
+    sendpkt->length = message.length;
+    memcpy(sendpkt->payload, message.data, message.length);
+    sendpkt->checksum = PacketChecksum(sendpkt);
+    a->acked[a->windowlast] = false;
+    a->windowcount++;
 
-    if (windowcount == 1)
-      starttimer(A, RTT);
+    if (TRACING(s, 1))
+      sim_printf(s, "Sending packet %d to layer 3\n", sendpkt->seqnum);
+    tolayer3_send(s, A, sharepacket(sendpkt));
 
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+    if (a->windowcount == 1)
+      starttimer(s, A, RTT);
+
+    a->A_nextseqnum = (a->A_nextseqnum + 1) % a->seqspace;
   }
   else
   {
-    if (TRACE > 0)
-      printf("----A: New message arrives, send window is full\n");
-    window_full++;
+    if (TRACING(s, 1))
+      sim_printf(s, "----A: New message arrives, send window is full\n");
+    sim_stats(s)->window_full++;
   }
 }
 
-void A_input(struct pkt packet)
+/* the packet is lent by the emulator for the duration of the call */
+void A_receive(struct sim *s, const struct pkt *packet)
 {
+  struct sender *a = sim_entity(s, A);
+
   if (!IsCorrupted(packet))
   {
-    if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
-    total_ACKs_received++;
+    if (TRACING(s, 1))
+      sim_printf(s, "----A: uncorrupted ACK %d is received\n", packet->acknum);
+    sim_stats(s)->total_ACKs_received++;
 
     // find ACK in buffer
-    for (int i = 0; i < windowcount; i++)
+    for (int i = 0; i < a->windowcount; i++)
     {
-      int idx = (windowfirst + i) % WINDOWSIZE;
-      if (buffer[idx].seqnum == packet.acknum)
+      int idx = (a->windowfirst + i) % a->windowsize;
+      if (a->buffer[idx]->seqnum == packet->acknum)
       {
-        if (!acked[idx])
+        if (!a->acked[idx])
         {
-          if (TRACE > 0)
-            printf("----A: ACK %d is not a duplicate\n", packet.acknum);
-          new_ACKs++;
-          acked[idx] = true;
+          if (TRACING(s, 1))
+            sim_printf(s, "----A: ACK %d is not a duplicate\n", packet->acknum);
+          sim_stats(s)->new_ACKs++;
+          a->acked[idx] = true;
 
           // ✅ Always slide over contiguous ACKs
-          stoptimer(A);
-          while (windowcount > 0 && acked[windowfirst])
+          stoptimer(s, A);
+          while (a->windowcount > 0 && a->acked[a->windowfirst])
           {
-            acked[windowfirst] = false;
-            windowfirst = (windowfirst + 1) % WINDOWSIZE;
-            windowcount--;
+            a->acked[a->windowfirst] = false;
+            droppacket(s, a->buffer[a->windowfirst]);
+            a->windowfirst = (a->windowfirst + 1) % a->windowsize;
+            a->windowcount--;
           }
-          if (windowcount > 0)
-            starttimer(A, RTT);
+          if (a->windowcount > 0)
+            starttimer(s, A, RTT);
         }
         else
         {
-          if (TRACE > 0)
-            printf("----A: duplicate ACK received, do nothing!\n");
+          if (TRACING(s, 1))
+            sim_printf(s, "----A: duplicate ACK received, do nothing!\n");
         }
         break;
       }
     }
   }
-  else if (TRACE > 0)
+  else if (TRACING(s, 1))
   {
-    printf("----A: corrupted ACK is received, do nothing!\n");
+    sim_printf(s, "----A: corrupted ACK is received, do nothing!\n");
   }
 }
 
-void A_timerinterrupt(void)
+void A_input(struct sim *s, struct pkt packet)
 {
-  if (TRACE > 0)
-    printf("----A: time out, resend all unACKed packets in buffer\n");
+  struct pkt *p = copypacket(s, &packet);
 
-  for (int i = 0; i < windowcount; i++)
+  A_receive(s, p);
+  droppacket(s, p);
+}
+
+void A_timerinterrupt(struct sim *s)
+{
+  struct sender *a = sim_entity(s, A);
+
+  if (TRACING(s, 1))
+    sim_printf(s, "----A: time out, resend all unACKed packets in buffer\n");
+
+  for (int i = 0; i < a->windowcount; i++)
   {
-    int idx = (windowfirst + i) % WINDOWSIZE;
-    if (!acked[idx])
+    int idx = (a->windowfirst + i) % a->windowsize;
+    if (!a->acked[idx])
     {
-      printf("---A: resending packet %d\n", buffer[idx].seqnum);
-      tolayer3(A, buffer[idx]);
-      packets_resent++;
+      if (TRACING(s, 0))
+        sim_printf(s, "---A: resending packet %d\n", a->buffer[idx]->seqnum);
+      tolayer3_send(s, A, sharepacket(a->buffer[idx]));
+      sim_stats(s)->packets_resent++;
     }
   }
 
-  starttimer(A, RTT); // Always restart timer
+  starttimer(s, A, RTT); // Always restart timer
+}
+
+/* fill in the state of A the emulator samples */
+void A_sample(struct sim *s, struct protosample *p)
+{
+  struct sender *a = sim_entity(s, A);
+
+  p->windowcount = a->windowcount;
 }
 
 /********* Receiver (B) variables and procedures ************/
-static struct pkt rbuffer[WINDOWSIZE];
-static bool rcvd[WINDOWSIZE];
-static int expectedseqnum;
-static int B_nextseqnum;
+struct receiver
+{
+  struct pkt **rbuffer; /* windowsize packets held by B, allocated behind the struct */
+  bool *rcvd;
+  int windowsize;
+  int seqspace;
+  int expectedseqnum;
+  int B_nextseqnum;
+};
+
+void B_init(struct sim *s)
+{
+  int w = sim_windowsize(s) > 0 ? sim_windowsize(s) : WINDOWSIZE;
+  struct receiver *b = malloc(sizeof(struct receiver) + w * (sizeof(struct pkt *) + sizeof(bool)));
 
-void B_init(void)
+  if (b == NULL)
+  {
+    printf("memory allocation for receiver failed.");
+    exit(EXIT_FAILURE);
+  }
+  sim_setentity(s, B, b);
+  b->rbuffer = (struct pkt **)(b + 1);
+  b->rcvd = (bool *)(b->rbuffer + w);
+  b->windowsize = w;
+  b->seqspace = w + 1;
+  b->expectedseqnum = 0;
+  b->B_nextseqnum = 1;
+  for (int i = 0; i < w; i++)
+    b->rcvd[i] = false;
+}
+
+/* ACKs are built straight into emulator packets */
+static void sendack(struct sim *s, struct receiver *b, int acknum)
 {
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
-  for (int i = 0; i < WINDOWSIZE; i++)
-    rcvd[i] = false;
+  struct pkt *sendpkt = newpacket(s);
+
+  sendpkt->seqnum = b->B_nextseqnum;
+  b->B_nextseqnum = (b->B_nextseqnum + 1) % b->seqspace;
+  sendpkt->acknum = acknum;
+  sendpkt->length = ACKSIZE;
+  memset(sendpkt->payload, '0', ACKSIZE);
+  sendpkt->checksum = PacketChecksum(sendpkt);
+  tolayer3_send(s, B, sendpkt);
 }
 
-void B_input(struct pkt packet)
+/* the packet is lent by the emulator for the duration of the call */
+void B_receive(struct sim *s, const struct pkt *packet)
 {
-  struct pkt sendpkt;
-  int seq = packet.seqnum;
-  int diff = (seq - expectedseqnum + SEQSPACE) % SEQSPACE;
-  bool inWindow = (diff < WINDOWSIZE);
+  struct receiver *b = sim_entity(s, B);
+  int seq = packet->seqnum;
+  int diff = (seq - b->expectedseqnum + b->seqspace) % b->seqspace;
+  bool inWindow = (diff < b->windowsize);
   bool newPkt = false;
 
   if (IsCorrupted(packet) || !inWindow)
   {
-    if (TRACE > 0)
-      printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
+    if (TRACING(s, 1))
+      sim_printf(s, "----B: packet corrupted or not expected sequence number, resend ACK!\n");
 
     // Send duplicate ACK for last correctly received packet
-    sendpkt.seqnum = B_nextseqnum;
-    B_nextseqnum = (B_nextseqnum + 1) % SEQSPACE;
-    sendpkt.acknum = (expectedseqnum - 1 + SEQSPACE) % SEQSPACE;
-    for (int i = 0; i < 20; i++)
-      sendpkt.payload[i] = '0';
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-    tolayer3(B, sendpkt);
+    sendack(s, b, (b->expectedseqnum - 1 + b->seqspace) % b->seqspace);
     return; // Drop corrupted or invalid packet silently — do NOT ACK
   }
 
-  if (!rcvd[seq % WINDOWSIZE])
+  if (!b->rcvd[seq % b->windowsize])
   {
-    if (TRACE > 0)
+    if (TRACING(s, 1))
     {
       if (diff == 0)
-        printf("----B: packet %d is correctly received, send ACK!\n", seq);
+        sim_printf(s, "----B: packet %d is correctly received, send ACK!\n", seq);
       else
-        printf("----B: packet %d correctly received but out of order, buffered!\n", seq);
+        sim_printf(s, "----B: packet %d correctly received but out of order, buffered!\n", seq);
     }
-    packets_received++;
-    rbuffer[seq % WINDOWSIZE] = packet;
-    rcvd[seq % WINDOWSIZE] = true;
+    sim_stats(s)->packets_received++;
+    b->rbuffer[seq % b->windowsize] = sharepacket(packet);
+    b->rcvd[seq % b->windowsize] = true;
     newPkt = true;
   }
   else
   {
-    if (TRACE > 0)
-      printf("----B: duplicate packet %d, already buffered, resend ACK!\n", seq);
+    if (TRACING(s, 1))
+      sim_printf(s, "----B: duplicate packet %d, already buffered, resend ACK!\n", seq);
   }
 
   /* send ACK for whatever seq we got */
-  sendpkt.seqnum = B_nextseqnum;
-  B_nextseqnum = (B_nextseqnum + 1) % SEQSPACE;
-  sendpkt.acknum = seq;
-  for (int i = 0; i < 20; i++)
-    sendpkt.payload[i] = '0';
-  sendpkt.checksum = ComputeChecksum(sendpkt);
-  tolayer3(B, sendpkt);
+  sendack(s, b, seq);
 
   /* deliver in-order packets only when we received a new one */
   if (newPkt)
   {
-    while (rcvd[expectedseqnum % WINDOWSIZE])
+    while (b->rcvd[b->expectedseqnum % b->windowsize])
     {
-      tolayer5(B, rbuffer[expectedseqnum % WINDOWSIZE].payload);
-      rcvd[expectedseqnum % WINDOWSIZE] = false;
-      expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
+      struct pkt *p = b->rbuffer[b->expectedseqnum % b->windowsize];
+
+      tolayer5_packet(s, B, p);
+      droppacket(s, p);
+      b->rcvd[b->expectedseqnum % b->windowsize] = false;
+      b->expectedseqnum = (b->expectedseqnum + 1) % b->seqspace;
     }
   }
 }
+
+void B_input(struct sim *s, struct pkt packet)
+{
+  struct pkt *p = copypacket(s, &packet);
+
+  B_receive(s, p);
+  droppacket(s, p);
+}
+/* fill in the state of B the emulator samples */
+void B_sample(struct sim *s, struct protosample *p)
+{
+  struct receiver *b = sim_entity(s, B);
+
+  p->buffered = 0;
+  for (int i = 0; i < b->windowsize; i++)
+    if (b->rcvd[i])
+      p->buffered++;
+}
+
 /******************************************************************************
  * The following functions need be completed only for bi-directional messages *
  *****************************************************************************/
-void B_output(struct msg message) {}
-void B_timerinterrupt(void) {}
\ No newline at end of file
+void B_output(struct sim *s, struct msg message) {}
+void B_timerinterrupt(struct sim *s) {}
\ No newline at end of file
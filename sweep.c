@@ -0,0 +1,299 @@
+/* sweep.c */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "emulator.h"
+#include "sweep.h"
+
+/* ******************************************************************
+   Parameter sweep driver.  Runs every configuration listed in a sweep
+   file, each with several seeds, on a pool of worker threads and writes
+   the end-of-run counters of every run to stdout.
+
+   Every line of the sweep file that is not empty and does not start
+   with '#' describes a grid: whitespace separated key=value[,value...]
+   fields with the keys of sim_setconfig().  All combinations of the
+   listed values are run, and keys left out keep their value in the base
+   configuration.  A plain list of configurations is one single-valued
+   line per configuration:
+
+     # 4 x 3 x 2 = 24 configurations
+     messages=100000 loss=0,0.1,0.2,0.3 lambda=5,10,20 window=6,12
+     messages=100000 loss=0.5 corrupt=0.5 direction=0
+
+   Run k of a configuration uses its seed + k, so run 0 reproduces the
+   single run with the same parameters.  Runs are not traced, sampled or
+   recorded, but all of them replay the channel given with -R.
+
+   Simulations share no state, so every run is an independent job.  Jobs
+   are dealt round robin onto one deque per worker; a worker takes jobs
+   from the back of its own deque and, once that is empty, steals from
+   the front of the others.  Results are stored per job and printed in
+   job order, so the output does not depend on the number of threads.
+
+   Build with:  make, or gcc -O2 emulator.c sr.c sweep.c -o sr -pthread
+   and add -DTRACE_MAX=-1 for a release build without tracing.
+**********************************************************************/
+
+#define SWEEP_KEYS 16      /* keys on one line */
+#define SWEEP_MAXVALUES 64 /* values per key on one line */
+#define SWEEP_LINE 4096    /* longest line of a sweep file */
+
+/* one line of a sweep file */
+struct grid
+{
+  int nkeys;
+  const char *key[SWEEP_KEYS];
+  double values[SWEEP_KEYS][SWEEP_MAXVALUES];
+  int nvalues[SWEEP_KEYS];
+};
+
+/* one simulation run */
+struct job
+{
+  struct simconfig config;
+  struct simresults results;
+};
+
+/* jobs not yet started by a worker, job[head..tail-1] */
+struct deque
+{
+  pthread_mutex_t lock;
+  int *job;
+  int head, tail;
+  char pad[64]; /* keep the deques of different workers on separate cache lines */
+};
+
+struct pool
+{
+  struct job *jobs;
+  struct deque *deques;
+  int nthreads;
+};
+
+struct worker
+{
+  pthread_t thread;
+  struct pool *pool;
+  int id;
+};
+
+static void sweep_fail(const char *file, int line, const char *what)
+{
+  fprintf(stderr, "sweep: %s line %d: %s\n", file, line, what);
+  exit(EXIT_FAILURE);
+}
+
+/* append every combination of the values on one line, nseeds runs each */
+static void addgrid(struct job **jobs, int *njobs, int *capacity, const struct simconfig *base,
+                    const struct grid *g, int nseeds)
+{
+  struct job *j;
+  int idx[SWEEP_KEYS] = {0};
+  int k, r;
+
+  while (1)
+  {
+    for (r = 0; r < nseeds; r++)
+    {
+      if (*njobs == *capacity)
+      {
+        *capacity = *capacity ? 2 * *capacity : 256;
+        *jobs = realloc(*jobs, *capacity * sizeof(struct job));
+        if (*jobs == NULL)
+        {
+          printf("memory allocation for sweep failed.");
+          exit(EXIT_FAILURE);
+        }
+      }
+      j = &(*jobs)[(*njobs)++];
+      memset(j, 0, sizeof(struct job));
+      j->config = *base;
+      for (k = 0; k < g->nkeys; k++)
+        sim_setconfig(&j->config, g->key[k], g->values[k][idx[k]]);
+      j->config.trace = TRACE_SILENT;
+      j->config.tracefile = NULL;
+      j->config.chanrecord = NULL;
+      j->config.samplefile = NULL;
+      j->config.seed += r;
+    }
+
+    /* next combination, the last key varying fastest */
+    for (k = g->nkeys - 1; k >= 0 && ++idx[k] == g->nvalues[k]; k--)
+      idx[k] = 0;
+    if (k < 0)
+      return;
+  }
+}
+
+/* read the sweep file into a job list */
+static struct job *readsweep(const struct simconfig *base, const char *file, int nseeds, int *njobs)
+{
+  struct grid g;
+  struct simconfig scratch;
+  char buf[SWEEP_LINE];
+  struct job *jobs = NULL;
+  int capacity = 0, line = 0, k;
+  char *field, *v, *end;
+  FILE *fp;
+
+  fp = fopen(file, "r");
+  if (fp == NULL)
+  {
+    fprintf(stderr, "sweep: cannot open %s\n", file);
+    exit(EXIT_FAILURE);
+  }
+  *njobs = 0;
+  while (fgets(buf, sizeof(buf), fp) != NULL)
+  {
+    line++;
+    if (strchr(buf, '\n') == NULL && !feof(fp))
+      sweep_fail(file, line, "line too long");
+    field = strtok(buf, " \t\r\n");
+    if (field == NULL || field[0] == '#')
+      continue;
+    for (g.nkeys = 0; field != NULL; field = strtok(NULL, " \t\r\n"))
+    {
+      v = strchr(field, '=');
+      if (v == NULL)
+        sweep_fail(file, line, "expected key=value");
+      *v++ = '\0';
+      if (!sim_setconfig(&scratch, field, 0.0))
+        sweep_fail(file, line, "unknown key");
+      for (k = 0; k < g.nkeys; k++)
+        if (strcmp(field, g.key[k]) == 0)
+          sweep_fail(file, line, "key given twice");
+      if (g.nkeys == SWEEP_KEYS)
+        sweep_fail(file, line, "too many keys");
+      k = g.nkeys++;
+      g.key[k] = field;
+      g.nvalues[k] = 0;
+      while (1)
+      {
+        if (g.nvalues[k] == SWEEP_MAXVALUES)
+          sweep_fail(file, line, "too many values");
+        g.values[k][g.nvalues[k]++] = strtod(v, &end);
+        if (end == v || (*end != ',' && *end != '\0') ||
+            !sim_setconfig(&scratch, field, g.values[k][g.nvalues[k] - 1]))
+          sweep_fail(file, line, "bad value");
+        if (*end == '\0')
+          break;
+        v = end + 1;
+      }
+    }
+    addgrid(&jobs, njobs, &capacity, base, &g, nseeds);
+  }
+  fclose(fp);
+  return jobs;
+}
+
+/* next job for worker self: its own newest, else the oldest of another */
+static int takejob(struct pool *p, int self)
+{
+  struct deque *d;
+  int i, j = -1;
+
+  d = &p->deques[self];
+  pthread_mutex_lock(&d->lock);
+  if (d->head < d->tail)
+    j = d->job[--d->tail];
+  pthread_mutex_unlock(&d->lock);
+
+  for (i = 1; j < 0 && i < p->nthreads; i++)
+  {
+    d = &p->deques[(self + i) % p->nthreads];
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail)
+      j = d->job[d->head++];
+    pthread_mutex_unlock(&d->lock);
+  }
+  return j;
+}
+
+static void *work(void *arg)
+{
+  struct worker *w = arg;
+  struct job *job;
+  struct sim *s;
+  int j;
+
+  /* no jobs are added once the workers run, so empty deques mean done */
+  while ((j = takejob(w->pool, w->id)) >= 0)
+  {
+    job = &w->pool->jobs[j];
+    s = sim_create(&job->config);
+    sim_run(s);
+    sim_results(s, &job->results);
+    sim_destroy(s);
+  }
+  return NULL;
+}
+
+int sweep(const struct simconfig *base, const char *file, int nseeds, int nthreads, int format)
+{
+  struct pool pool;
+  struct worker *workers;
+  int njobs, i, j;
+
+  pool.jobs = readsweep(base, file, nseeds, &njobs);
+  if (nthreads <= 0)
+    nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads > njobs)
+    nthreads = njobs;
+  if (nthreads < 1)
+    nthreads = 1;
+  pool.nthreads = nthreads;
+
+  pool.deques = calloc(nthreads, sizeof(struct deque));
+  workers = calloc(nthreads, sizeof(struct worker));
+  if (pool.deques == NULL || workers == NULL)
+  {
+    printf("memory allocation for sweep failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nthreads; i++)
+  {
+    pthread_mutex_init(&pool.deques[i].lock, NULL);
+    pool.deques[i].job = malloc((njobs / nthreads + 1) * sizeof(int));
+    if (pool.deques[i].job == NULL)
+    {
+      printf("memory allocation for sweep failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  /* deal the jobs round robin, so neighbouring configurations spread out */
+  for (j = 0; j < njobs; j++)
+  {
+    struct deque *d = &pool.deques[j % nthreads];
+    d->job[d->tail++] = j;
+  }
+
+  for (i = 0; i < nthreads; i++)
+  {
+    workers[i].pool = &pool;
+    workers[i].id = i;
+    if (pthread_create(&workers[i].thread, NULL, work, &workers[i]) != 0)
+    {
+      fprintf(stderr, "sweep: cannot start worker thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (i = 0; i < nthreads; i++)
+    pthread_join(workers[i].thread, NULL);
+
+  sim_printheader(format);
+  for (j = 0; j < njobs; j++)
+    sim_printresults(format, &pool.jobs[j].results);
+
+  for (i = 0; i < nthreads; i++)
+  {
+    pthread_mutex_destroy(&pool.deques[i].lock);
+    free(pool.deques[i].job);
+  }
+  free(pool.deques);
+  free(workers);
+  free(pool.jobs);
+  return EXIT_SUCCESS;
+}
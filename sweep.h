@@ -0,0 +1,7 @@
+// sweep.h
+/* run every configuration of a sweep file nseeds times on nthreads worker */
+/* threads (0 = one per online CPU) and print the results of each run in   */
+/* the given RESULTS_ format.  Fields the sweep file does not set, such as */
+/* the scheduler, come from the base config.  Returns the exit status for  */
+/* main().                                                                 */
+extern int sweep(const struct simconfig *, const char *, int, int, int);